@@ -0,0 +1,177 @@
+#ifndef ADAPTIVE_CONTROL_HH_
+#define ADAPTIVE_CONTROL_HH_
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include "alias_table.hh"
+#include "mutation_strategy.hh"
+#include "checkpoint.hh"
+
+
+// Online control of the search from the outcome of the mutations, updated
+// after every generation. A mutation is compared with its parent evaluated on
+// the batch of the offspring.
+// - The mutation operators with a positive weight are drawn by probability
+//   matching: every operator is drawn with a probability proportional to its
+//   rate of offspring fitter than their parent, counted with an exponential
+//   decay and a prior proportional to its weight, with a floor so that none
+//   of them is abandoned.
+// - The fraction ds of random inputs follows the 1/5th success rule on the
+//   odds ds/(1-ds), an offspring strictly fitter than its parent being a
+//   success: it grows while more than 1/5 of the mutations succeed and
+//   shrinks otherwise, replaying more fails when the search stalls. Neutral
+//   mutations are most of them and would only ever push ds up.
+// - The batch size doubles when most survivors have no wrong output on their
+//   batch, which then cannot tell them apart, and halves back towards the
+//   requested size once few of them do.
+class AdaptiveControl {
+public:
+    // Bounds of the batch size as a multiple of the requested one and of ds
+    static constexpr unsigned max_batch_shift = 4;
+    static constexpr double min_ds = 0.05;
+    static constexpr double max_ds = 0.95;
+
+    AdaptiveControl() = default;
+
+    explicit AdaptiveControl(const MutationWeights& weights) {
+	double sum = 0;
+	for (unsigned k = 0 ; k < weights.weight.size() ; ++k) {
+	    if (weights.weight[k] > 0) {
+		operators_.push_back(MutationOperator(k));
+		prior_.push_back(weights.weight[k]);
+		sum += weights.weight[k];
+	    }
+	}
+	for (auto& p : prior_)
+	    p *= prior_rate * operators_.size() / sum;
+	improvements_.assign(operators_.size(), 0);
+	trials_.assign(operators_.size(), 0);
+	rate_.resize(operators_.size());
+	p_.resize(operators_.size());
+	build_table();
+    }
+
+    template<typename Rng_t>
+    MutationOperator draw(Rng_t& rng) const {
+	return operators_.size() == 1 ? operators_[0] : operators_[table_(rng)];
+    }
+
+    // Fraction of random inputs and batch size derived from the requested ones
+    double ds(double requested) const {
+	const double odds = std::log(requested / (1 - requested)) + log_odds_shift_;
+	return std::clamp(1 / (1 + std::exp(-odds)), min_ds, max_ds);
+    }
+
+    unsigned b(unsigned requested, size_t input_count) const {
+	return std::max<size_t>(requested, std::min<size_t>(size_t(requested) << batch_shift_, input_count));
+    }
+
+    void record_mutation(MutationOperator op, double fitness, double parent_fitness) {
+	const size_t k = std::find(operators_.begin(), operators_.end(), op) - operators_.begin();
+	if (k == operators_.size())
+	    return;
+	const bool improved = fitness > parent_fitness;
+	improvements_[k] += improved;
+	++trials_[k];
+	accepted_ += improved;
+	++generation_trials_;
+    }
+
+    // Survivor whose batch fitness is or is not 1
+    void record_survivor(bool perfect) {
+	perfect_survivors_ += perfect;
+	++survivors_;
+    }
+
+    // Apply the outcome of the generation and start a new one
+    void update() {
+	build_table();
+	if (generation_trials_ > 0) {
+	    // On average +1 per success and -1/4 per failure
+	    const double rate = double(accepted_) / generation_trials_;
+	    log_odds_shift_ = std::clamp(log_odds_shift_ + ds_step * (5*rate - 1) / 4, -max_log_odds_shift, max_log_odds_shift);
+	}
+	if (survivors_ > 0) {
+	    if (2*perfect_survivors_ > survivors_)
+		batch_shift_ = std::min(batch_shift_ + 1, max_batch_shift);
+	    else if (8*perfect_survivors_ < survivors_ && batch_shift_ > 0)
+		--batch_shift_;
+	}
+	for (unsigned k = 0 ; k < operators_.size() ; ++k) {
+	    improvements_[k] *= decay;
+	    trials_[k] *= decay;
+	}
+	accepted_ = 0;
+	generation_trials_ = 0;
+	perfect_survivors_ = 0;
+	survivors_ = 0;
+    }
+
+    void save(std::ostream& os) const {
+	snapshot::write(os, improvements_);
+	snapshot::write(os, trials_);
+	snapshot::write(os, log_odds_shift_);
+	snapshot::write(os, batch_shift_);
+    }
+
+    void load(std::istream& is) {
+	snapshot::read(is, improvements_);
+	snapshot::read(is, trials_);
+	snapshot::read(is, log_odds_shift_);
+	snapshot::read(is, batch_shift_);
+	improvements_.resize(operators_.size(), 0);
+	trials_.resize(operators_.size(), 0);
+	build_table();
+    }
+
+private:
+    // The prior counts as prior_trials trials with an improvement rate of
+    // prior_rate for an operator of average weight
+    static constexpr double prior_rate = 0.05;
+    static constexpr double prior_trials = 20;
+    // Decay of the counts per generation
+    static constexpr double decay = 0.98;
+    // Share of the probability spread evenly over the operators
+    static constexpr double floor_share = 0.1;
+    static constexpr double ds_step = 0.5;
+    // ds is clamped anyway, this only bounds the recovery time
+    static constexpr double max_log_odds_shift = 6;
+
+    std::vector<MutationOperator> operators_;
+    std::vector<double> prior_;
+    // Decayed counts of the offspring fitter than their parent and of all
+    // the offspring of every operator
+    std::vector<double> improvements_;
+    std::vector<double> trials_;
+    // Improvement rates and probabilities of the operators, reused by every
+    // update of the table
+    std::vector<double> rate_;
+    std::vector<double> p_;
+    AliasTable table_;
+    double log_odds_shift_ = 0;
+    unsigned batch_shift_ = 0;
+    // Outcome of the current generation
+    unsigned accepted_ = 0;
+    unsigned generation_trials_ = 0;
+    unsigned perfect_survivors_ = 0;
+    unsigned survivors_ = 0;
+
+    void build_table() {
+	if (operators_.size() < 2)
+	    return;
+	double sum = 0;
+	for (unsigned k = 0 ; k < operators_.size() ; ++k) {
+	    rate_[k] = (improvements_[k] + prior_[k]*prior_trials) / (trials_[k] + prior_trials);
+	    sum += rate_[k];
+	}
+	for (unsigned k = 0 ; k < operators_.size() ; ++k)
+	    p_[k] = floor_share / operators_.size() + (1 - floor_share) * (sum > 0 ? rate_[k] / sum : 1.0 / operators_.size());
+	table_.build(p_);
+    }
+};
+
+
+#endif // ADAPTIVE_CONTROL_HH_
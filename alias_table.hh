@@ -0,0 +1,80 @@
+#ifndef ALIAS_TABLE_HH_
+#define ALIAS_TABLE_HH_
+
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <vector>
+#include <random>
+
+
+// Walker's alias method: draws index i with probability weights[i]/sum(weights)
+// in constant time with two integer draws. Every column k is kept with
+// probability threshold[k]/2^32 and replaced by its alias otherwise.
+class AliasTable {
+public:
+    AliasTable() = default;
+
+    explicit AliasTable(const std::vector<double>& weights) { build(weights); }
+
+    // Rebuild the table for new weights, reusing its storage
+    void build(const std::vector<double>& weights) {
+	const size_t n = weights.size();
+	assert(n > 0);
+	threshold_.resize(n);
+	alias_.resize(n);
+	double sum = 0;
+	for (double w : weights)
+	    sum += w;
+	assert(sum > 0);
+	// Vose's construction with the probabilities scaled to an average of 1
+	scaled_.resize(n);
+	small_.clear();
+	large_.clear();
+	for (size_t k = 0 ; k < n ; ++k) {
+	    scaled_[k] = weights[k] * n / sum;
+	    (scaled_[k] < 1 ? small_ : large_).push_back(k);
+	}
+	while (!small_.empty() && !large_.empty()) {
+	    const uint32_t s = small_.back();
+	    const uint32_t l = large_.back();
+	    small_.pop_back();
+	    threshold_[s] = static_cast<uint64_t>(scaled_[s] * 4294967296.0);
+	    alias_[s] = l;
+	    scaled_[l] -= 1 - scaled_[s];
+	    if (scaled_[l] < 1) {
+		large_.pop_back();
+		small_.push_back(l);
+	    }
+	}
+	// What is left is 1 up to rounding errors
+	for (uint32_t k : large_) {
+	    threshold_[k] = uint64_t(1) << 32;
+	    alias_[k] = k;
+	}
+	for (uint32_t k : small_) {
+	    threshold_[k] = uint64_t(1) << 32;
+	    alias_[k] = k;
+	}
+    }
+
+    size_t size() const { return alias_.size(); }
+
+    template<typename Rng_t>
+    size_t operator()(Rng_t& rng) const {
+	const size_t k = std::uniform_int_distribution<size_t>(0, alias_.size()-1)(rng);
+	const uint32_t u = std::uniform_int_distribution<uint32_t>()(rng);
+	return u < threshold_[k] ? k : alias_[k];
+    }
+
+private:
+    std::vector<uint64_t> threshold_;
+    std::vector<uint32_t> alias_;
+    // Construction scratch space
+    std::vector<double> scaled_;
+    std::vector<uint32_t> small_;
+    std::vector<uint32_t> large_;
+};
+
+
+#endif // ALIAS_TABLE_HH_
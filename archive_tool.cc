@@ -0,0 +1,71 @@
+#include "circuit.hh"
+#include "circuit_archive.hh"
+
+#include <string>
+#include <limits>
+#include <iostream>
+#include <boost/program_options.hpp>
+
+
+namespace po = boost::program_options;
+
+
+// Export the records of binary circuit archives matching the filters in the
+// text format of the optimizer output files
+int main(int argc, char *argv[]) {
+    using Reg_t = uint64_t;
+
+    po::options_description desc("Allowed options");
+    desc.add_options()
+	("help,h", "Print this help")
+	("archive", po::value<std::vector<std::string>>(), "Archives to read")
+	("max_error,e", po::value<double>()->default_value(1), "Only export circuits with at most this error rate")
+	("max_quantum_cost,q", po::value<unsigned>()->default_value(std::numeric_limits<unsigned>::max()), "Only export circuits with at most this quantum cost")
+	("num_gates,d", po::value<unsigned>(), "Only export circuits with this number of gates")
+	("count", po::bool_switch(), "Only print the number of matching circuits");
+    po::positional_options_description pos;
+    pos.add("archive", -1);
+    const auto usage = [&] {
+	std::cout << "Usage: " << argv[0] << " [options] archive..." << std::endl;
+	std::cout << desc << std::endl;
+    };
+    po::variables_map vm;
+    try {
+	po::store(po::command_line_parser(argc, argv).options(desc).positional(pos).run(), vm);
+    }
+    catch (const po::error& e) {
+	std::cout << e.what() << std::endl;
+	usage();
+	exit(1);
+    }
+
+    if (vm.count("help")) {
+	usage();
+	return 0;
+    }
+    if (vm.count("archive") == 0) {
+	usage();
+	exit(1);
+    }
+
+    const double max_e = vm["max_error"].as<double>();
+    const unsigned max_qc = vm["max_quantum_cost"].as<unsigned>();
+    const bool count_only = vm["count"].as<bool>();
+    size_t count = 0;
+    for (const auto& path : vm["archive"].as<std::vector<std::string>>()) {
+	ArchiveReader reader(path);
+	for (const auto record : reader) {
+	    if (record.e() > max_e || record.qc() > max_qc || (vm.count("num_gates") && record.d() != vm["num_gates"].as<unsigned>()))
+		continue;
+	    ++count;
+	    if (count_only)
+		continue;
+	    record.circuit<Reg_t>().serialize(std::cout);
+	    std::cout << record.l() << ' ' << record.d() << ' ' << record.e() << ' ' << record.fn() << ' ' << record.fp() << ' ' << record.qc() << '\n';
+	}
+    }
+    if (count_only)
+	std::cout << count << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,282 @@
+#include "instruction.hh"
+#include "circuit.hh"
+#include "optimizer.hh"
+#include "functions.hh"
+#include "mutation_strategy.hh"
+#include "bit_sliced_registers.hh"
+#include "truth_table.hh"
+
+#include <cstdint>
+#include <cmath>
+#include <chrono>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <random>
+#include <numeric>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <functional>
+#include <optional>
+#include <boost/program_options.hpp>
+#include <omp.h>
+
+
+namespace po = boost::program_options;
+
+
+// Repeated timings of one benchmark, as rates of work units per second
+struct Measurement {
+    std::string name;
+    std::string unit;
+    std::vector<double> rates;
+
+    double mean() const { return std::accumulate(rates.begin(), rates.end(), 0.0) / rates.size(); }
+
+    double stddev() const {
+	if (rates.size() < 2)
+	    return 0;
+	const double m = mean();
+	double sum = 0;
+	for (double r : rates)
+	    sum += (r - m) * (r - m);
+	return std::sqrt(sum / (rates.size() - 1));
+    }
+
+    double min() const { return *std::min_element(rates.begin(), rates.end()); }
+    double max() const { return *std::max_element(rates.begin(), rates.end()); }
+};
+
+
+struct BenchOptions {
+    unsigned repetitions = 5;
+    // Minimum duration of a repetition in seconds
+    double min_time = 0.1;
+    // Only run the benchmarks whose name contains the filter
+    std::string filter;
+};
+
+
+// Results are folded into this so that the timed work is not optimized away
+uint64_t sink = 0;
+
+
+class Bench {
+public:
+    explicit Bench(const BenchOptions& options) : options_(options) {}
+
+    // Time fn, which does work units of the given unit per call. The number
+    // of calls per repetition is calibrated on a first untimed call. If there
+    // is a reset, it is called untimed before the calibration and every
+    // repetition so that they all start from the same state.
+    void run(const std::string& name, const std::string& unit, double work, const std::function<void()>& fn, const std::function<void()>& reset = {}) {
+	if (name.find(options_.filter) == std::string::npos)
+	    return;
+	using clock = std::chrono::steady_clock;
+	if (reset)
+	    reset();
+	const auto start = clock::now();
+	fn();
+	const double once = std::max(std::chrono::duration<double>(clock::now() - start).count(), 1e-9);
+	const size_t calls = std::max<size_t>(1, options_.min_time / once);
+	Measurement m{name, unit, {}};
+	for (unsigned r = 0 ; r < options_.repetitions ; ++r) {
+	    if (reset)
+		reset();
+	    const auto t0 = clock::now();
+	    for (size_t c = 0 ; c < calls ; ++c)
+		fn();
+	    m.rates.push_back(calls * work / std::chrono::duration<double>(clock::now() - t0).count());
+	}
+	std::cout << std::left << std::setw(48) << name << std::right << std::scientific << std::setprecision(3)
+		  << std::setw(12) << m.mean() << " " << unit << "/s  +- " << std::fixed << std::setprecision(1) << 100 * m.stddev() / m.mean() << "%" << std::endl;
+	measurements_.push_back(std::move(m));
+    }
+
+    // Machine-readable results: one object per benchmark with every
+    // repetition, to compare builds
+    void write_json(std::ostream& os, const std::string& label) const {
+	os << std::setprecision(9);
+	os << "{\n";
+	os << "  \"label\": \"" << label << "\",\n";
+	os << "  \"time\": " << std::time(nullptr) << ",\n";
+	os << "  \"compiler\": \"" << __VERSION__ << "\",\n";
+	os << "  \"repetitions\": " << options_.repetitions << ",\n";
+	os << "  \"min_time\": " << options_.min_time << ",\n";
+	os << "  \"benchmarks\": [";
+	for (size_t k = 0 ; k < measurements_.size() ; ++k) {
+	    const Measurement& m = measurements_[k];
+	    os << (k ? ",\n" : "\n") << "    {\"name\": \"" << m.name << "\", \"unit\": \"" << m.unit << "/s\", \"mean\": " << m.mean()
+	       << ", \"stddev\": " << m.stddev() << ", \"min\": " << m.min() << ", \"max\": " << m.max() << ", \"rates\": [";
+	    for (size_t r = 0 ; r < m.rates.size() ; ++r)
+		os << (r ? ", " : "") << m.rates[r];
+	    os << "]}";
+	}
+	os << "\n  ]\n}\n";
+    }
+
+private:
+    const BenchOptions options_;
+    std::vector<Measurement> measurements_;
+};
+
+
+// One gate of every type on the first lines
+template<typename Reg_t>
+std::vector<std::pair<std::string, Instruction<Reg_t>>> gates_per_type() {
+    return {
+	{"Id", Instruction<Reg_t>(Gate::Id, 0)},
+	{"X", Instruction<Reg_t>(Gate::X, 0)},
+	{"cX", Instruction<Reg_t>(Gate::cX, 0, 1)},
+	{"ccX", Instruction<Reg_t>(Gate::ccX, 0, 1, 2)},
+	{"Swap", Instruction<Reg_t>(Gate::Swap, 0, 1)},
+	{"cSwap", Instruction<Reg_t>(Gate::cSwap, 0, 1, 2)},
+	{"mcX", Instruction<Reg_t>(Reg_t(1), Reg_t(0x1e), Reg_t(0x04))},
+	{"mcSwap", Instruction<Reg_t>(Reg_t(3), Reg_t(0x1c), Reg_t(0x08))},
+    };
+}
+
+
+// Instruction::apply on registers and on bit-planes, in gates applied to one
+// register per second
+void bench_apply(Bench& bench) {
+    using Reg_t = uint8_t;
+    constexpr size_t n = 4096;
+    std::mt19937 rng(1);
+    std::vector<Reg_t> regs(n);
+    for (auto& r : regs)
+	r = Reg_t(rng());
+    BitSlicedRegisters<> planes(8, regs);
+    for (const auto& [name, gate] : gates_per_type<Reg_t>()) {
+	bench.run("apply/registers/" + name, "gates", n, [&] {
+	    gate.apply(regs.data(), regs.size());
+	    sink += regs[0];
+	});
+	bench.run("apply/bit_sliced/" + name, "gates", n, [&] {
+	    gate.apply(planes);
+	    sink += planes.plane(0)[0];
+	});
+    }
+}
+
+
+// Circuit::run of random circuits on 4096 registers
+template<typename Reg_t>
+void bench_run(Bench& bench, const std::string& width, const std::vector<unsigned>& line_counts) {
+    constexpr size_t n = 4096;
+    std::mt19937 rng(1);
+    for (unsigned l : line_counts) {
+	FullyConnectedMutationStrategy<Reg_t> mut_strat(l);
+	std::vector<Reg_t> regs(n);
+	std::uniform_int_distribution<uint64_t> dist(0, l < 64 ? (uint64_t(1) << l) - 1 : ~uint64_t(0));
+	for (auto& r : regs)
+	    r = Reg_t(dist(rng));
+	for (unsigned d : {10u, 100u, 1000u}) {
+	    Circuit<Reg_t> circuit(l, d);
+	    mut_strat.randomize(rng, circuit);
+	    bench.run("run/" + width + "/l" + std::to_string(l) + "/d" + std::to_string(d), "gates", double(n) * d, [&] {
+		circuit.run(regs);
+		sink += static_cast<uint64_t>(regs[0]);
+	    });
+	}
+    }
+}
+
+
+// Sweep parameters of a function in the Makefile
+struct BenchFunction {
+    std::string name;
+    TruthTable func;
+    unsigned l;
+    unsigned S;
+    unsigned F;
+    unsigned b;
+};
+
+
+// Circuit::errors, Optimizer::evaluate and generations of the optimizer for
+// every function at depth d
+void bench_functions(Bench& bench, unsigned d) {
+    using Reg_t = uint16_t;
+    const std::vector<BenchFunction> functions = {
+	{"2of5", TruthTable::tabulate(Func2of5{}), 6, 100, 100, 32},
+	{"4mod5", TruthTable::tabulate(Func4mod5{}), 5, 30, 50, 16},
+	{"5mod5", TruthTable::tabulate(Func5mod5{}), 6, 60, 100, 32},
+	{"6sym", TruthTable::tabulate(Func6sym{}), 7, 60, 100, 64},
+	{"9sym", TruthTable::tabulate(Func9sym{}), 10, 60, 100, 180},
+	{"Xor5", TruthTable::tabulate(FuncXor5{}), 5, 60, 100, 32},
+	{"NthPrime3", TruthTable::tabulate(FuncNthPrime3{}), 5, 30, 50, 8},
+	{"NthPrime4", TruthTable::tabulate(FuncNthPrime4{}), 6, 30, 50, 16},
+    };
+    for (const auto& f : functions) {
+	std::mt19937 rng(1);
+	FullyConnectedMutationStrategy<Reg_t> mut_strat(f.l);
+	Circuit<Reg_t> circuit(f.l, d);
+	mut_strat.randomize(rng, circuit);
+	bench.run("errors/" + f.name, "evaluations", 1, [&] {
+	    sink += std::get<0>(circuit.errors(f.func)) > 0;
+	});
+	for (bool exhaustive : {false, true}) {
+	    OptimizerOptions options;
+	    options.exhaustive = exhaustive;
+	    const std::string mode = exhaustive ? "/exhaustive" : "/sampled";
+	    Optimizer<Reg_t, FullyConnectedMutationStrategy<Reg_t>> optimizer(rng, f.func, f.l, d, f.S, f.F, mut_strat, options);
+	    bench.run("evaluate/" + f.name + mode, "evaluations", double(f.S) * f.F, [&] {
+		sink += optimizer.evaluate(rng, 0.5, f.b)[0] > 0;
+	    });
+	    // Every repetition runs the same generations from a new optimizer
+	    std::optional<Optimizer<Reg_t, FullyConnectedMutationStrategy<Reg_t>>> evolving;
+	    std::mt19937 evolving_rng;
+	    bench.run("generation/" + f.name + mode, "generations", 1, [&] {
+		evolving->optimize(evolving_rng, 1, 0.5, f.b);
+	    }, [&] {
+		evolving_rng.seed(2);
+		evolving.emplace(evolving_rng, f.func, f.l, d, f.S, f.F, mut_strat, options);
+	    });
+	}
+    }
+}
+
+
+// Micro-benchmarks of the gates and the circuit simulation and
+// macro-benchmarks of the optimizer on the built-in functions
+int main(int argc, char *argv[]) {
+    po::options_description desc("Allowed options");
+    desc.add_options()
+	("help,h", "Print this help")
+	("repetitions,r", po::value<unsigned>()->default_value(5), "Number of timed repetitions of every benchmark")
+	("min_time,t", po::value<double>()->default_value(0.1), "Minimum duration of a repetition in seconds")
+	("filter", po::value<std::string>()->default_value(""), "Only run the benchmarks whose name contains this string")
+	("num_gates,d", po::value<unsigned>()->default_value(20), "Number of gates of the circuits of the function benchmarks")
+	("json", po::value<std::string>(), "File to write the results to in JSON")
+	("label", po::value<std::string>()->default_value(""), "Label of the build stored in the JSON output, e.g. a commit");
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    if (vm.count("help")) {
+	std::cout << desc << std::endl;
+	return 0;
+    }
+
+    BenchOptions options;
+    options.repetitions = std::max(1u, vm["repetitions"].as<unsigned>());
+    options.min_time = vm["min_time"].as<double>();
+    options.filter = vm["filter"].as<std::string>();
+    // The optimizer benchmarks are sequential
+    omp_set_num_threads(1);
+
+    Bench bench(options);
+    bench_apply(bench);
+    bench_run<uint8_t>(bench, "u8", {5, 8});
+    bench_run<uint16_t>(bench, "u16", {10, 16});
+    bench_run<uint32_t>(bench, "u32", {20, 32});
+    bench_run<uint64_t>(bench, "u64", {40, 64});
+    bench_run<unsigned __int128>(bench, "u128", {100, 128});
+    bench_functions(bench, vm["num_gates"].as<unsigned>());
+
+    if (vm.count("json")) {
+	std::ofstream os(vm["json"].as<std::string>());
+	bench.write_json(os, vm["label"].as<std::string>());
+    }
+    return 0;
+}
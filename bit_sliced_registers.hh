@@ -0,0 +1,199 @@
+#ifndef BIT_SLICED_REGISTERS_HH_
+#define BIT_SLICED_REGISTERS_HH_
+
+#include <climits>
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <vector>
+#include <algorithm>
+#include "bits.hh"
+
+
+// Transposed storage of a batch of registers: every circuit line is a
+// bit-plane holding the value of that line for all registers of the batch.
+template<typename Word_t = uint64_t>
+class BitSlicedRegisters {
+public:
+    static constexpr unsigned word_bits = CHAR_BIT*sizeof(Word_t);
+
+    BitSlicedRegisters(unsigned l, size_t n) : l_(l), n_(n), words_((n+word_bits-1)/word_bits), planes_(l_*words_, 0) {}
+    BitSlicedRegisters() = default;
+    BitSlicedRegisters(const BitSlicedRegisters&) = default;
+    BitSlicedRegisters(BitSlicedRegisters&&) = default;
+    BitSlicedRegisters& operator=(const BitSlicedRegisters&) = default;
+    BitSlicedRegisters& operator=(BitSlicedRegisters&&) = default;
+
+    template<typename Reg_t>
+    BitSlicedRegisters(unsigned l, const std::vector<Reg_t>& regs) : BitSlicedRegisters(l, regs.size()) { load(regs); }
+
+    unsigned l() const { return l_; }
+    size_t size() const { return n_; }
+    size_t words() const { return words_; }
+
+    Word_t* plane(unsigned line) { return planes_.data() + line*words_; }
+    const Word_t* plane(unsigned line) const { return planes_.data() + line*words_; }
+
+    // Mask of the bits of word w that belong to actual registers
+    Word_t valid_mask(size_t w) const {
+	const size_t rem = n_ - w*word_bits;
+	return rem >= word_bits ? ~Word_t(0) : (Word_t(1) << rem) - 1;
+    }
+
+    void resize(unsigned l, size_t n) {
+	l_ = l;
+	n_ = n;
+	words_ = (n+word_bits-1) / word_bits;
+	planes_.assign(l_*words_, 0);
+    }
+
+    template<typename Reg_t>
+    void load(const std::vector<Reg_t>& regs) {
+	assert(regs.size() == n_);
+	std::fill(planes_.begin(), planes_.end(), Word_t(0));
+	for (size_t k = 0 ; k < n_ ; ++k) {
+	    const Word_t bit = Word_t(1) << (k % word_bits);
+	    for (unsigned line = 0 ; line < l_ ; ++line) {
+		if ((regs[k] >> line) & 1)
+		    plane(line)[k / word_bits] |= bit;
+	    }
+	}
+    }
+
+    template<typename Reg_t>
+    void store(std::vector<Reg_t>& regs) const {
+	regs.assign(n_, Reg_t(0));
+	for (size_t k = 0 ; k < n_ ; ++k) {
+	    for (unsigned line = 0 ; line < l_ ; ++line) {
+		if ((plane(line)[k / word_bits] >> (k % word_bits)) & 1)
+		    regs[k] |= Reg_t(1) << line;
+	    }
+	}
+    }
+
+    void apply_X(unsigned t) {
+	Word_t* pt = plane(t);
+	for (size_t w = 0 ; w < words_ ; ++w)
+	    pt[w] = ~pt[w];
+    }
+
+    void apply_cX(unsigned t, unsigned c) {
+	Word_t* pt = plane(t);
+	const Word_t* pc = plane(c);
+	for (size_t w = 0 ; w < words_ ; ++w)
+	    pt[w] ^= pc[w];
+    }
+
+    void apply_ccX(unsigned t, unsigned c1, unsigned c2) {
+	Word_t* pt = plane(t);
+	const Word_t* pc1 = plane(c1);
+	const Word_t* pc2 = plane(c2);
+	for (size_t w = 0 ; w < words_ ; ++w)
+	    pt[w] ^= pc1[w] & pc2[w];
+    }
+
+    void apply_Swap(unsigned t1, unsigned t2) {
+	Word_t* pt1 = plane(t1);
+	Word_t* pt2 = plane(t2);
+	for (size_t w = 0 ; w < words_ ; ++w) {
+	    const Word_t m = pt1[w] ^ pt2[w];
+	    pt1[w] ^= m;
+	    pt2[w] ^= m;
+	}
+    }
+
+    void apply_cSwap(unsigned t1, unsigned t2, unsigned c) {
+	Word_t* pt1 = plane(t1);
+	Word_t* pt2 = plane(t2);
+	const Word_t* pc = plane(c);
+	for (size_t w = 0 ; w < words_ ; ++w) {
+	    const Word_t m = pc[w] & (pt1[w] ^ pt2[w]);
+	    pt1[w] ^= m;
+	    pt2[w] ^= m;
+	}
+    }
+
+    // Flip all lines in target for the registers in which all lines in ctrl
+    // are set, except the lines in neg which have to be cleared
+    template<typename Mask_t>
+    void apply_toggle(Mask_t ctrl, Mask_t neg, Mask_t target) {
+	unsigned c[CHAR_BIT*sizeof(Mask_t)];
+	Word_t inv[CHAR_BIT*sizeof(Mask_t)];
+	const unsigned nc = lines(ctrl, neg, c, inv);
+	for (; target ; target &= target-1) {
+	    const unsigned t = bits::countr_zero(target);
+	    switch (neg ? 3 : nc) {
+		case 0:
+		    apply_X(t);
+		    break;
+		case 1:
+		    apply_cX(t, c[0]);
+		    break;
+		case 2:
+		    apply_ccX(t, c[0], c[1]);
+		    break;
+		default: {
+		    Word_t* pt = plane(t);
+		    for (size_t w = 0 ; w < words_ ; ++w) {
+			Word_t m = ~Word_t(0);
+			for (unsigned k = 0 ; k < nc ; ++k)
+			    m &= plane(c[k])[w] ^ inv[k];
+			pt[w] ^= m;
+		    }
+		    break;
+		}
+	    }
+	}
+    }
+
+    // Swap the two lines in target for the registers in which all lines in
+    // ctrl are set, except the lines in neg which have to be cleared
+    template<typename Mask_t>
+    void apply_swap(Mask_t ctrl, Mask_t neg, Mask_t target) {
+	unsigned c[CHAR_BIT*sizeof(Mask_t)];
+	Word_t inv[CHAR_BIT*sizeof(Mask_t)];
+	unsigned t[CHAR_BIT*sizeof(Mask_t)];
+	Word_t unused[CHAR_BIT*sizeof(Mask_t)];
+	const unsigned nc = lines(ctrl, neg, c, inv);
+	if (lines(target, Mask_t(0), t, unused) != 2)
+	    return;
+	if (nc == 0) {
+	    apply_Swap(t[0], t[1]);
+	}
+	else if (nc == 1 && !neg) {
+	    apply_cSwap(t[0], t[1], c[0]);
+	}
+	else {
+	    Word_t* pt1 = plane(t[0]);
+	    Word_t* pt2 = plane(t[1]);
+	    for (size_t w = 0 ; w < words_ ; ++w) {
+		Word_t m = pt1[w] ^ pt2[w];
+		for (unsigned k = 0 ; k < nc ; ++k)
+		    m &= plane(c[k])[w] ^ inv[k];
+		pt1[w] ^= m;
+		pt2[w] ^= m;
+	    }
+	}
+    }
+
+private:
+    unsigned l_ = 0;
+    size_t n_ = 0;
+    size_t words_ = 0;
+    std::vector<Word_t> planes_;
+
+    // Lines of the mask and, for each of them, the word inverting its plane
+    // if it is in neg
+    template<typename Mask_t>
+    static unsigned lines(Mask_t mask, Mask_t neg, unsigned* idx, Word_t* inv) {
+	unsigned n = 0;
+	for (; mask ; mask &= mask-1, ++n) {
+	    idx[n] = bits::countr_zero(mask);
+	    inv[n] = -Word_t((neg >> idx[n]) & 1);
+	}
+	return n;
+    }
+};
+
+
+#endif // BIT_SLICED_REGISTERS_HH_
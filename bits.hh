@@ -0,0 +1,52 @@
+#ifndef BITS_HH_
+#define BITS_HH_
+
+#include <cstdint>
+#include <bit>
+
+
+// Bit operations on registers. The ones of <bit> only take the standard
+// unsigned types, these also take unsigned __int128 registers by splitting
+// them into their 64-bit halves.
+namespace bits {
+
+template<typename Reg_t>
+constexpr bool is_wide = sizeof(Reg_t) > sizeof(uint64_t);
+
+
+template<typename Reg_t>
+constexpr int popcount(Reg_t x) {
+    if constexpr (is_wide<Reg_t>)
+	return std::popcount(static_cast<uint64_t>(x)) + std::popcount(static_cast<uint64_t>(x >> 64));
+    else
+	return std::popcount(x);
+}
+
+
+template<typename Reg_t>
+constexpr int countr_zero(Reg_t x) {
+    if constexpr (is_wide<Reg_t>)
+	return static_cast<uint64_t>(x) ? std::countr_zero(static_cast<uint64_t>(x)) : 64 + std::countr_zero(static_cast<uint64_t>(x >> 64));
+    else
+	return std::countr_zero(x);
+}
+
+
+template<typename Reg_t>
+constexpr int bit_width(Reg_t x) {
+    if constexpr (is_wide<Reg_t>)
+	return (x >> 64) ? 64 + std::bit_width(static_cast<uint64_t>(x >> 64)) : std::bit_width(static_cast<uint64_t>(x));
+    else
+	return std::bit_width(x);
+}
+
+
+template<typename Reg_t>
+constexpr Reg_t bit_floor(Reg_t x) {
+    return x ? Reg_t(Reg_t(1) << (bit_width(x) - 1)) : Reg_t(0);
+}
+
+} // namespace bits
+
+
+#endif // BITS_HH_
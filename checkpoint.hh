@@ -0,0 +1,151 @@
+#ifndef CHECKPOINT_HH_
+#define CHECKPOINT_HH_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <type_traits>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+// Raw binary encoding of the optimizer state. Snapshots are only read back by
+// the same binary on the same machine, so no byte order conversion is done.
+namespace snapshot {
+
+template<typename T>
+void write(std::ostream& os, const T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template<typename T>
+void read(std::istream& is, T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    is.read(reinterpret_cast<char*>(&value), sizeof(T));
+}
+
+template<typename T>
+void write(std::ostream& os, const std::vector<T>& values) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    write(os, uint64_t(values.size()));
+    os.write(reinterpret_cast<const char*>(values.data()), values.size()*sizeof(T));
+}
+
+template<typename T>
+void read(std::istream& is, std::vector<T>& values) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    uint64_t n = 0;
+    read(is, n);
+    values.resize(n);
+    is.read(reinterpret_cast<char*>(values.data()), n*sizeof(T));
+}
+
+inline void write(std::ostream& os, const std::string& str) {
+    write(os, uint64_t(str.size()));
+    os.write(str.data(), str.size());
+}
+
+inline void read(std::istream& is, std::string& str) {
+    uint64_t n = 0;
+    read(is, n);
+    str.resize(n);
+    is.read(str.data(), n);
+}
+
+} // namespace snapshot
+
+
+struct CheckpointOptions {
+    // Number of generations between two snapshots of an optimizer, 0
+    // disables the checkpoints
+    unsigned interval = 0;
+    // Continue from the snapshots and output files of an interrupted run
+    bool resume = false;
+};
+
+
+// Writes snapshots to disk on a background thread so that the optimization
+// only pays for encoding them in memory. A snapshot replaces any pending one
+// for the same file, and files are replaced atomically through a rename.
+class CheckpointWriter {
+public:
+    CheckpointWriter() : worker_([this] { run(); }) {}
+    CheckpointWriter(const CheckpointWriter&) = delete;
+    CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+    ~CheckpointWriter() {
+	{
+	    std::lock_guard<std::mutex> lock(mutex_);
+	    done_ = true;
+	}
+	cv_.notify_one();
+	worker_.join();
+    }
+
+    void write(const std::string& path, std::string data) { submit({path, std::move(data), false}); }
+
+    // Delete the file once the pending operations on it are done
+    void remove(const std::string& path) { submit({path, std::string(), true}); }
+
+private:
+    struct Task {
+	std::string path;
+	std::string data;
+	bool remove;
+    };
+
+    std::deque<Task> queue_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool done_ = false;
+    std::thread worker_;
+
+    void submit(Task task) {
+	{
+	    std::lock_guard<std::mutex> lock(mutex_);
+	    auto it = std::find_if(queue_.begin(), queue_.end(), [&task](const Task& t) { return t.path == task.path; });
+	    if (it != queue_.end())
+		*it = std::move(task);
+	    else
+		queue_.push_back(std::move(task));
+	}
+	cv_.notify_one();
+    }
+
+    void run() {
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true) {
+	    cv_.wait(lock, [this] { return done_ || !queue_.empty(); });
+	    if (queue_.empty())
+		return;
+	    Task task = std::move(queue_.front());
+	    queue_.pop_front();
+	    lock.unlock();
+	    std::error_code ec;
+	    if (task.remove) {
+		std::filesystem::remove(task.path, ec);
+	    }
+	    else {
+		const std::string tmp = task.path + ".tmp";
+		std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+		file.write(task.data.data(), task.data.size());
+		file.close();
+		if (file)
+		    std::filesystem::rename(tmp, task.path, ec);
+		else
+		    std::cout << "Could not write checkpoint '" << task.path << "'" << std::endl;
+	    }
+	    lock.lock();
+	}
+    }
+};
+
+
+#endif // CHECKPOINT_HH_
@@ -11,25 +11,45 @@
 #include <algorithm>
 #include <numeric>
 #include <sstream>
+#include <bit>
 #include "instruction.hh"
+#include "bit_sliced_registers.hh"
+#include "compiled_circuit.hh"
+#include "truth_table.hh"
+#include "rewrite.hh"
+
+
+// Zobrist key of a gate at a given position, the hash of a circuit is the XOR
+// of the keys of all its gates
+template<typename Reg_t>
+uint64_t zobrist(unsigned idx, const Instruction<Reg_t>& inst) {
+    return splitmix64(uint64_t(idx) << 32 ^ inst.key());
+}
 
 
 template<typename Reg_t>
 class Circuit {
 public:
-    Circuit(unsigned l, unsigned d) : inst_(d), l_(l) { assert(l <= CHAR_BIT*sizeof(Reg_t)); }
+    Circuit(unsigned l, unsigned d) : inst_(d, Instruction<Reg_t>(Gate::Id, 0)), l_(l) { assert(l <= CHAR_BIT*sizeof(Reg_t)); rehash(); }
     Circuit() = default;
     Circuit(const Circuit&) = default;
     Circuit(Circuit&&) = default;
     Circuit& operator=(const Circuit&) = default;
     Circuit& operator=(Circuit&&) = default;
 
-    Instruction<Reg_t>& operator[](unsigned idx) { return inst_[idx]; }
     const Instruction<Reg_t>& operator[](unsigned idx) const { return inst_[idx]; }
 
+    void set(unsigned idx, const Instruction<Reg_t>& inst) {
+	hash_ ^= zobrist(idx, inst_[idx]) ^ zobrist(idx, inst);
+	inst_[idx] = inst;
+    }
+
     unsigned l() const { return l_; }
     unsigned d() const { return inst_.size(); }
 
+    // Zobrist hash of the gate sequence, maintained incrementally by set
+    uint64_t hash() const { return hash_; }
+
     unsigned quantum_cost() const {
 	unsigned qc = 0;
 	for (auto&& i : inst_)
@@ -38,8 +58,21 @@ public:
     }
 
     void extend(unsigned n) {
-	for (unsigned i = 0 ; i < n ; ++i)
+	for (unsigned i = 0 ; i < n ; ++i) {
 	    inst_.emplace_back(Gate::Id, 0, 0, 0);
+	    hash_ ^= zobrist(inst_.size()-1, inst_.back());
+	}
+    }
+
+    // Copy with d gates, the missing ones being Id gates spread evenly between
+    // the gates so that a mutation can grow the circuit anywhere
+    Circuit<Reg_t> padded(unsigned d) const {
+	assert(d >= this->d());
+	Circuit<Reg_t> circuit(l_, d);
+	const unsigned n = this->d();
+	for (unsigned k = 0 ; k < n ; ++k)
+	    circuit.set(k + uint64_t(k+1)*(d-n)/(n+1), inst_[k]);
+	return circuit;
     }
 
     template<typename Iterable>
@@ -48,39 +81,35 @@ public:
 	    inst.apply(input);
     }
 
-    template<typename Func_t>
-    std::tuple<double, double, double> errors(const Func_t& func) const {
+    std::tuple<double, double, double> errors(const TruthTable& func) const {
 	// Test the circuit with every possible input
-	const Reg_t input_count = Reg_t(1) << func.input_size;
-	std::vector<Reg_t> inputs(input_count);
+	const unsigned output_size = func.output_size();
+	std::vector<Reg_t> inputs(func.input_count());
 	std::iota(inputs.begin(), inputs.end(), Reg_t(0));
-	// Run the circuit on the samples
-	auto outputs = inputs;
-	run(outputs);
+	const BitSlicedRegisters<>& expected = func.planes();
+	// Run the compiled circuit on the bit-sliced samples
+	BitSlicedRegisters<> outputs(l_, inputs);
+	CompiledCircuit<Reg_t>(*this).run(outputs);
 	// Compute the errors
 	size_t num_positive = 0;
 	double e = 0;
 	double fn = 0;
 	double fp = 0;
-	for (size_t i = 0 ; i < input_count ; ++i) {
-	    const Reg_t in = inputs[i];
-	    const Reg_t out = (outputs[i] >> (l_-Func_t::output_size)) & ((Reg_t(1) << Func_t::output_size)-1);
-	    const Reg_t exact = func.func_eval(in);
-	    for (int bit = 0 ; bit < Func_t::output_size ; ++bit) {
-		if (((exact>>bit)&1) == 1)
-		    ++num_positive;
-		if (((out>>bit)&1) != ((exact>>bit)&1)) {
-		    ++e;
-		    if (((exact>>bit)&1) == 0 && ((out>>bit)&1) == 1)
-			++fp;
-		    else
-			++fn;
-		}
+	for (unsigned bit = 0 ; bit < output_size ; ++bit) {
+	    const auto out = outputs.plane(l_-output_size+bit);
+	    const auto ex = expected.plane(bit);
+	    for (size_t w = 0 ; w < outputs.words() ; ++w) {
+		const auto valid = outputs.valid_mask(w);
+		const auto wrong = (out[w] ^ ex[w]) & valid;
+		num_positive += std::popcount(ex[w]);
+		e += std::popcount(wrong);
+		fp += std::popcount(wrong & ~ex[w]);
+		fn += std::popcount(wrong & ex[w]);
 	    }
 	}
-	e /= Func_t::output_size * inputs.size();
+	e /= output_size * inputs.size();
 	fn /= num_positive;
-	fp /= Func_t::output_size*inputs.size() - num_positive;
+	fp /= output_size*inputs.size() - num_positive;
 	return {e, fn, fp};
     }
 
@@ -98,19 +127,35 @@ public:
 	circuit.inst_.resize(d);
 	for (unsigned i = 0 ; i < d ; ++i)
 	    is >> circuit.inst_[i];
+	circuit.rehash();
 	return circuit;
     }
 
+    // Equivalent circuit on the output lines with the Id and dead gates
+    // removed and the rest rewritten into fewer or cheaper gates
     Circuit<Reg_t> simplified(unsigned output_size=1) const {
 	Circuit<Reg_t> simp = *this;
 	simp.remove_identity();
-	simp.remove_unnecessary_gates(output_size);
+	// Removing dead gates can let more gates cancel and conversely
+	for (unsigned d = simp.d() + 1 ; simp.d() < d ;) {
+	    d = simp.d();
+	    rewrite::rewrite(simp.inst_);
+	    simp.remove_unnecessary_gates(output_size);
+	}
+	simp.rehash();
 	return simp;
     }
 
 private:
     std::vector<Instruction<Reg_t>> inst_;
     unsigned l_;
+    uint64_t hash_ = 0;
+
+    void rehash() {
+	hash_ = 0;
+	for (unsigned i = 0 ; i < d() ; ++i)
+	    hash_ ^= zobrist(i, inst_[i]);
+    }
 
     void remove_identity() {
 	inst_.erase(std::remove_if(begin(inst_),
@@ -121,55 +166,27 @@ private:
 		    end(inst_));
     }
 
-    int last_unnecessary_gate(unsigned output_size) const {
-	Reg_t unused_bits = ((Reg_t(1)<<output_size)-1) << (l_-output_size);
-	int idx;
-	for (idx = d()-1 ; idx >= 0 ; --idx) {
-	    const auto args = inst_[idx].args();
-	    switch (inst_[idx].type()) {
-		case Gate::Id:
-		    return idx;
-		case Gate::X:
-		    if (!(args[0] & unused_bits))
-			return idx;
-		    break;
-		case Gate::cX:
-		    if (!(args[0] & unused_bits))
-			return idx;
-		    else
-			unused_bits |= args[1];
-		    break;
-		case Gate::ccX:
-		    if (!(args[0] & unused_bits))
-			return idx;
-		    else
-			unused_bits |= args[1] | args[2];
-		    break;
-		case Gate::Swap:
-		    if (!(args[0] & unused_bits) && !(args[1] & unused_bits))
-			return idx;
-		    else
-			unused_bits |= args[0] | args[1];
-		    break;
-		case Gate::cSwap:
-		    if (!(args[0] & unused_bits) && !(args[1] & unused_bits))
-			return idx;
-		    else
-			unused_bits |= args[0] | args[1] | args[2];
-		    break;
-		default:
-		    break;
-	    }
-	}
-	return idx;
-    }
-
+    // Remove the gates none of whose targets is used by a later gate or is an
+    // output, in one backward pass
     void remove_unnecessary_gates(unsigned output_size=1) {
-	int idx = last_unnecessary_gate(output_size);
-	while (idx >= 0) {
-	    inst_.erase(begin(inst_)+idx);
-	    idx = last_unnecessary_gate(output_size);
+	// Without a shift by the full register width, which is undefined
+	constexpr unsigned reg_bits = CHAR_BIT*sizeof(Reg_t);
+	Reg_t used_bits = output_size == 0 ? Reg_t(0) : (Reg_t(~Reg_t(0)) >> (reg_bits - output_size)) << (l_ - output_size);
+	std::vector<bool> necessary(d());
+	for (int idx = d()-1 ; idx >= 0 ; --idx) {
+	    const auto& inst = inst_[idx];
+	    // A gate is necessary if one of its targets is used later on, all
+	    // its lines are then used
+	    necessary[idx] = inst.type() != Gate::Id && (inst.target() & used_bits);
+	    if (necessary[idx])
+		used_bits |= inst.ctrl() | (inst.is_swap() ? inst.target() : Reg_t(0));
+	}
+	unsigned n = 0;
+	for (unsigned i = 0 ; i < d() ; ++i) {
+	    if (necessary[i])
+		inst_[n++] = inst_[i];
 	}
+	inst_.resize(n);
     }
 };
 
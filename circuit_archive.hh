@@ -0,0 +1,247 @@
+#ifndef CIRCUIT_ARCHIVE_HH_
+#define CIRCUIT_ARCHIVE_HH_
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cassert>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <iterator>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bits.hh"
+#include "instruction.hh"
+#include "circuit.hh"
+
+
+// Binary archive of optimized circuits with their metrics. The file starts
+// with an ArchiveHeader followed by records, each an ArchiveRecord followed
+// by its d gates and padded to a multiple of 8 bytes. Gates store the lines
+// of their targets and 64-bit masks of their controls so that the format does
+// not depend on Reg_t. Records are only ever appended, a reader ignores an
+// incomplete last record.
+constexpr uint32_t archive_magic = 0x52414343;
+constexpr uint32_t archive_version = 2;
+// Circuits with more lines do not fit in the masks
+constexpr unsigned archive_max_lines = 64;
+
+
+struct ArchiveHeader {
+    uint32_t magic;
+    uint32_t version;
+};
+
+
+struct ArchiveRecord {
+    uint32_t l;
+    uint32_t d;
+    uint32_t qc;
+    int32_t seed;
+    double e;
+    double fn;
+    double fp;
+};
+
+
+struct ArchiveGate {
+    uint8_t type;
+    // Both targets of a swap, the second one is the first one for toggles
+    uint8_t target[2];
+    uint8_t reserved[5];
+    uint64_t ctrl;
+    uint64_t neg;
+};
+
+
+static_assert(sizeof(ArchiveHeader) == 8 && sizeof(ArchiveRecord) == 40 && sizeof(ArchiveGate) == 24);
+
+
+// Size of a record with d gates including its padding
+inline size_t archive_record_size(uint32_t d) {
+    return (sizeof(ArchiveRecord) + d*sizeof(ArchiveGate) + 7) & ~size_t(7);
+}
+
+
+class ArchiveWriter {
+public:
+    // Appends to the archive, creating it if it does not exist
+    ArchiveWriter(const std::string& path) {
+	const bool exists = std::filesystem::exists(path) && std::filesystem::file_size(path) > 0;
+	if (exists) {
+	    std::ifstream is(path, std::ios::binary);
+	    ArchiveHeader header;
+	    is.read(reinterpret_cast<char*>(&header), sizeof(header));
+	    if (!is || header.magic != archive_magic || header.version != archive_version) {
+		std::cout << "'" << path << "' is not a circuit archive of version " << archive_version << std::endl;
+		exit(1);
+	    }
+	}
+	file_.open(path, std::ios::binary | std::ios::app);
+	if (!file_) {
+	    std::cout << "Could not open archive '" << path << "'" << std::endl;
+	    exit(1);
+	}
+	if (!exists) {
+	    const ArchiveHeader header{archive_magic, archive_version};
+	    file_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	}
+    }
+
+    ArchiveWriter(const ArchiveWriter&) = delete;
+    ArchiveWriter& operator=(const ArchiveWriter&) = delete;
+
+    template<typename Reg_t>
+    void append(const Circuit<Reg_t>& circuit, unsigned qc, int seed, double e, double fn, double fp) {
+	assert(circuit.l() <= archive_max_lines);
+	const ArchiveRecord record{circuit.l(), circuit.d(), qc, seed, e, fn, fp};
+	buffer_.assign(archive_record_size(record.d), 0);
+	std::memcpy(buffer_.data(), &record, sizeof(record));
+	for (unsigned i = 0 ; i < circuit.d() ; ++i) {
+	    const auto& inst = circuit[i];
+	    const ArchiveGate gate{static_cast<uint8_t>(inst.type()),
+				   {static_cast<uint8_t>(bits::countr_zero(inst.target())), static_cast<uint8_t>(bits::bit_width(inst.target()) - 1)},
+				   {}, static_cast<uint64_t>(inst.ctrl()), static_cast<uint64_t>(inst.neg())};
+	    std::memcpy(buffer_.data() + sizeof(record) + i*sizeof(gate), &gate, sizeof(gate));
+	}
+	// A record is written at once and only visible to readers when complete
+	file_.write(buffer_.data(), buffer_.size());
+	file_.flush();
+    }
+
+private:
+    std::ofstream file_;
+    std::string buffer_;
+};
+
+
+// Record of a mapped archive, only valid as long as its reader
+class ArchiveRecordView {
+public:
+    explicit ArchiveRecordView(const char* data) : data_(data) {}
+
+    const ArchiveRecord& record() const { return *reinterpret_cast<const ArchiveRecord*>(data_); }
+    unsigned l() const { return record().l; }
+    unsigned d() const { return record().d; }
+    unsigned qc() const { return record().qc; }
+    int seed() const { return record().seed; }
+    double e() const { return record().e; }
+    double fn() const { return record().fn; }
+    double fp() const { return record().fp; }
+
+    const ArchiveGate& gate(unsigned i) const { return reinterpret_cast<const ArchiveGate*>(data_ + sizeof(ArchiveRecord))[i]; }
+
+    template<typename Reg_t>
+    Instruction<Reg_t> instruction(unsigned i) const {
+	const ArchiveGate& g = gate(i);
+	const Gate type = static_cast<Gate>(g.type);
+	const bool swap = type == Gate::Swap || type == Gate::cSwap || type == Gate::mcSwap;
+	// Swapping a line with itself is an identity as well
+	if (type == Gate::Id || (swap && g.target[0] == g.target[1]))
+	    return Instruction<Reg_t>(Gate::Id, g.target[0]);
+	return Instruction<Reg_t>(Reg_t(Reg_t(1) << g.target[0] | Reg_t(1) << g.target[1]), Reg_t(g.ctrl), Reg_t(g.neg));
+    }
+
+    template<typename Reg_t>
+    Circuit<Reg_t> circuit() const {
+	Circuit<Reg_t> c(l(), d());
+	for (unsigned i = 0 ; i < d() ; ++i)
+	    c.set(i, instruction<Reg_t>(i));
+	return c;
+    }
+
+    size_t size() const { return archive_record_size(d()); }
+
+private:
+    const char* data_;
+};
+
+
+// Read-only memory mapping of an archive iterating over its records in place
+class ArchiveReader {
+public:
+    class iterator {
+    public:
+	using iterator_category = std::forward_iterator_tag;
+	using value_type = ArchiveRecordView;
+	using difference_type = std::ptrdiff_t;
+	using pointer = void;
+	using reference = ArchiveRecordView;
+
+	iterator(const char* pos, const char* end) : pos_(pos), end_(end) { skip_incomplete(); }
+
+	ArchiveRecordView operator*() const { return ArchiveRecordView(pos_); }
+
+	iterator& operator++() {
+	    pos_ += ArchiveRecordView(pos_).size();
+	    skip_incomplete();
+	    return *this;
+	}
+
+	iterator operator++(int) {
+	    iterator it = *this;
+	    ++*this;
+	    return it;
+	}
+
+	bool operator==(const iterator& other) const { return pos_ == other.pos_; }
+	bool operator!=(const iterator& other) const { return pos_ != other.pos_; }
+
+    private:
+	const char* pos_;
+	const char* end_;
+
+	// Move to the end if the record at the position is incomplete
+	void skip_incomplete() {
+	    if (static_cast<size_t>(end_ - pos_) < sizeof(ArchiveRecord) || static_cast<size_t>(end_ - pos_) < ArchiveRecordView(pos_).size())
+		pos_ = end_;
+	}
+    };
+
+    ArchiveReader(const std::string& path) {
+	const int fd = open(path.c_str(), O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+	    std::cout << "Could not open archive '" << path << "'" << std::endl;
+	    exit(1);
+	}
+	size_ = st.st_size;
+	if (size_ > 0) {
+	    void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+	    if (data == MAP_FAILED) {
+		std::cout << "Could not map archive '" << path << "'" << std::endl;
+		exit(1);
+	    }
+	    data_ = static_cast<const char*>(data);
+	}
+	close(fd);
+	const auto* header = reinterpret_cast<const ArchiveHeader*>(data_);
+	if (size_ < sizeof(ArchiveHeader) || header->magic != archive_magic || header->version != archive_version) {
+	    std::cout << "'" << path << "' is not a circuit archive of version " << archive_version << std::endl;
+	    exit(1);
+	}
+	madvise(const_cast<char*>(data_), size_, MADV_SEQUENTIAL);
+    }
+
+    ArchiveReader(const ArchiveReader&) = delete;
+    ArchiveReader& operator=(const ArchiveReader&) = delete;
+
+    ~ArchiveReader() {
+	if (data_)
+	    munmap(const_cast<char*>(data_), size_);
+    }
+
+    iterator begin() const { return iterator(data_ + sizeof(ArchiveHeader), data_ + size_); }
+    iterator end() const { return iterator(data_ + size_, data_ + size_); }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+
+#endif // CIRCUIT_ARCHIVE_HH_
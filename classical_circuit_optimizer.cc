@@ -3,27 +3,609 @@
 #include "optimizer.hh"
 #include "functions.hh"
 #include "mutation_strategy.hh"
+#include "checkpoint.hh"
+#include "circuit_archive.hh"
+#include "tfc.hh"
+#include "noisy_simulator.hh"
+#include "telemetry.hh"
 
 #include <sstream>
 #include <random>
 #include <fstream>
 #include <string>
 #include <cstdlib>
+#include <iomanip>
+#include <filesystem>
+#include <set>
+#include <memory>
 #include <boost/program_options.hpp>
 #include <omp.h>
+#ifdef USE_MPI
+#include "island.hh"
+#endif
 
 
 namespace po = boost::program_options;
 
 
-int main(int argc, char *argv[]) {
-    using Reg_t = uint16_t;
+// Settings of a run shared by all its optimizations, read from the command
+// line by main and passed down explicitly
+struct RunConfig {
+#ifdef USE_MPI
+    // Migrations between the islands run by the MPI ranks
+    MigrationOptions migration;
+#endif
+    // Snapshots of the optimizers, written in the background
+    CheckpointOptions checkpoint;
+    std::unique_ptr<CheckpointWriter> checkpoint_writer;
+    // Binary archive every written circuit is also appended to, if any
+    std::unique_ptr<ArchiveWriter> archive_writer;
+    // Also write every written circuit to its own TFC file
+    bool export_tfc = false;
+    // Statistics of every generation, if requested
+    std::unique_ptr<TelemetryWriter> telemetry_writer;
+    // Maximum number of generations of an optimization per gate
+    unsigned generations_per_gate = 100;
+    // Number of circuits of every optimization that seed the optimization
+    // with the same index at the next depth, 0 starts every depth from random
+    // circuits
+    unsigned warm_start = 0;
+};
+
+
+RunConfig read_run_config(const po::variables_map& vm, int rank, int num_ranks) {
+    RunConfig config;
+#ifdef USE_MPI
+    config.migration.interval = vm["migration_interval"].as<unsigned>();
+    config.migration.size = vm["migration_size"].as<unsigned>();
+    config.migration.topology = parse_topology(vm["topology"].as<std::string>());
+#endif
+    config.checkpoint.interval = vm["checkpoint_interval"].as<unsigned>();
+    config.checkpoint.resume = vm["resume"].as<bool>();
+    if (config.checkpoint.interval > 0)
+	config.checkpoint_writer = std::make_unique<CheckpointWriter>();
+    if (vm.count("archive") && vm["num_lines"].as<unsigned>() > archive_max_lines) {
+	std::cout << "Circuits with more than " << archive_max_lines << " lines cannot be archived" << std::endl;
+	exit(1);
+    }
+    if (vm.count("archive") && rank == 0)
+	config.archive_writer = std::make_unique<ArchiveWriter>(vm["archive"].as<std::string>());
+    config.export_tfc = vm["tfc"].as<bool>();
+    if (vm.count("telemetry")) {
+	// Every rank writes its own file
+	std::string path = vm["telemetry"].as<std::string>();
+	if (num_ranks > 1)
+	    path += ".rank" + std::to_string(rank);
+	config.telemetry_writer = std::make_unique<TelemetryWriter>(path);
+    }
+    config.generations_per_gate = vm["generations_per_gate"].as<unsigned>();
+    config.warm_start = vm["warm_start"].as<unsigned>();
+    return config;
+}
+
+
+constexpr uint32_t checkpoint_magic = 0x50434343;
+constexpr uint32_t checkpoint_version = 6;
+
+
+template<typename Rng_t, typename Optimizer_t>
+void save_checkpoint(CheckpointWriter& writer, const std::string& path, const Rng_t& rng, const Optimizer_t& optimizer) {
+    std::ostringstream os(std::ios::binary);
+    snapshot::write(os, checkpoint_magic);
+    snapshot::write(os, checkpoint_version);
+    std::ostringstream rng_state;
+    rng_state << rng;
+    snapshot::write(os, rng_state.str());
+    optimizer.save(os);
+    writer.write(path, os.str());
+}
+
+
+// Returns false if there is no snapshot to resume from
+template<typename Rng_t, typename Optimizer_t>
+bool load_checkpoint(const std::string& path, Rng_t& rng, Optimizer_t& optimizer) {
+    std::ifstream is(path, std::ios::binary);
+    if (!is)
+	return false;
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    snapshot::read(is, magic);
+    snapshot::read(is, version);
+    std::string rng_state;
+    snapshot::read(is, rng_state);
+    if (magic != checkpoint_magic || version != checkpoint_version || !optimizer.load(is)) {
+	std::cout << "Checkpoint '" << path << "' does not match the parameters of the run" << std::endl;
+	exit(1);
+    }
+    std::istringstream(rng_state) >> rng;
+    return true;
+}
+
+
+// Snapshot file of an optimization of a run writing to output
+std::string checkpoint_name(const std::string& output, unsigned d, unsigned restart) {
+    std::ostringstream name;
+    name << output << ".d" << d << ".r" << restart;
+#ifdef USE_MPI
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    name << ".rank" << rank;
+#endif
+    name << ".ckpt";
+    return name.str();
+}
+
+
+// Depths whose best circuit is already in an output file. An incomplete last
+// record left by an interruption is cut off so that the run can append to it.
+std::set<unsigned> completed_depths(const std::string& path) {
+    std::set<unsigned> depths;
+    std::ifstream is(path);
+    if (!is)
+	return depths;
+    std::streampos end = 0;
+    std::string line;
+    while (std::getline(is, line)) {
+	// A record is the serialized circuit followed by its statistics
+	unsigned l, d;
+	if (!(std::istringstream(line) >> l >> d))
+	    break;
+	unsigned i = 0;
+	for (; i < d && std::getline(is, line) ; ++i);
+	if (i < d || !std::getline(is, line))
+	    break;
+	std::istringstream stats(line);
+	unsigned stats_l, stats_d, qc;
+	double e, fn, fp;
+	if (!(stats >> stats_l >> stats_d >> e >> fn >> fp >> qc) || is.eof())
+	    break;
+	depths.insert(d);
+	end = is.tellg();
+    }
+    is.close();
+    std::filesystem::resize_file(path, end);
+    return depths;
+}
+
+
+template<typename Reg_t>
+struct OptimizationResult {
+    Circuit<Reg_t> best;
+    std::tuple<double, double, double> errors;
+    std::pair<uint64_t, uint64_t> cache;
+    // Generations run, fewer than the maximum if a stopping criterion was met
+    unsigned generations = 0;
+    // The best circuit followed by the fittest survivors, config.warm_start in
+    // total
+    std::vector<Circuit<Reg_t>> elites;
+    unsigned input_size = 0;
+    unsigned output_size = 0;
+};
+
+
+// Truth table of a built-in function or of a function read from a PLA or
+// .spec file
+TruthTable load_function(const std::string& name) {
+    #define BUILTIN(fn) return TruthTable::tabulate(fn{})
+    if (name == "2of5") {
+	BUILTIN(Func2of5);
+    }
+    else if (name == "4mod5") {
+	BUILTIN(Func4mod5);
+    }
+    else if (name == "5mod5") {
+	BUILTIN(Func5mod5);
+    }
+    else if (name == "6sym") {
+	BUILTIN(Func6sym);
+    }
+    else if (name == "9sym") {
+	BUILTIN(Func9sym);
+    }
+    else if (name == "Id") {
+	BUILTIN(FuncId);
+    }
+    else if (name == "Xor5") {
+	BUILTIN(FuncXor5);
+    }
+    else if (name == "NthPrime3") {
+	BUILTIN(FuncNthPrime3);
+    }
+    else if (name == "NthPrime4") {
+	BUILTIN(FuncNthPrime4);
+    }
+    #undef BUILTIN
+    const auto extension = std::filesystem::path(name).extension();
+    if (extension == ".pla" || extension == ".spec")
+	return read_truth_table(name);
+    std::cout << "Unknown function: '" << name << "'" << std::endl;
+    exit(1);
+}
+
+
+template<typename Reg_t, typename Rng_t, typename MutStrat_t>
+OptimizationResult<Reg_t> optimize(const TruthTable& func, Rng_t& rng, unsigned l, unsigned d, unsigned S, unsigned F, unsigned b, MutStrat_t& mut_strat, const OptimizerOptions& options,
+				   const RunConfig& config, const Circuit<Reg_t>* initial, const std::vector<Circuit<Reg_t>>& warm, const std::string& checkpoint, int seed, unsigned restart) {
+    Optimizer<Reg_t, MutStrat_t> optimizer(rng, func, l, d, S, F, mut_strat, options);
+    if (config.telemetry_writer)
+	optimizer.set_telemetry(config.telemetry_writer.get(), seed, restart);
+    if (!warm.empty()) {
+	optimizer.warm_start(rng, warm);
+    }
+    else if (initial) {
+	// Start one family from the initial circuit, padded with Id gates or
+	// simplified to fit the depth
+	Circuit<Reg_t> circuit = initial->d() > d ? initial->simplified(func.output_size()) : *initial;
+	if (circuit.d() <= d) {
+	    circuit.extend(d - circuit.d());
+	    optimizer.immigrate(rng, {circuit});
+	}
+	else {
+	    std::cout << "Warning: the seed circuit has " << circuit.d() << " gates after simplification, more than " << d
+		      << ", the optimization starts from random circuits" << std::endl;
+	}
+    }
+    const unsigned generations = config.generations_per_gate*d;
+    if (config.checkpoint.resume)
+	load_checkpoint(checkpoint, rng, optimizer);
+    bool stopped = false;
+    while (optimizer.generation() < generations && !stopped) {
+	unsigned n = generations - optimizer.generation();
+	if (config.checkpoint.interval > 0)
+	    n = std::min(n, config.checkpoint.interval);
+#ifdef USE_MPI
+	stopped = optimize_island<Reg_t>(optimizer, rng, n, 0.5, b, config.migration, MPI_COMM_WORLD);
+#else
+	optimizer.optimize(rng, n, 0.5, b);
+	stopped = optimizer.stopped();
+#endif
+	if (config.checkpoint.interval > 0 && !stopped)
+	    save_checkpoint(*config.checkpoint_writer, checkpoint, rng, optimizer);
+    }
+    OptimizationResult<Reg_t> result;
+    result.best = optimizer.compute_best();
+    result.errors = result.best.errors(func);
+    result.cache = {optimizer.cache_hits(), optimizer.cache_misses()};
+    result.generations = optimizer.generation();
+    if (config.warm_start > 0) {
+	result.elites = optimizer.elites(config.warm_start - 1);
+	result.elites.insert(result.elites.begin(), result.best);
+    }
+    result.input_size = func.input_size();
+    result.output_size = func.output_size();
+    return result;
+}
+
+
+// Print the errors and quantum cost of a circuit read from a file, in TFC or
+// in the text format of the output files, and its errors under the noise
+// model if there is one
+template<typename Reg_t>
+void evaluate(const std::string& function_name, const std::string& path, const NoiseModel* noise, unsigned shots, uint64_t seed) {
+    std::ifstream is(path);
+    if (!is) {
+	std::cout << "Could not open '" << path << "'" << std::endl;
+	exit(1);
+    }
+    const bool is_tfc = std::filesystem::path(path).extension() == ".tfc";
+    TfcCircuit<Reg_t> tfc;
+    if (is_tfc)
+	tfc = read_tfc<Reg_t>(is);
+    else
+	tfc.circuit = Circuit<Reg_t>::deserialize(is);
+    const TruthTable func = load_function(function_name);
+    if (is_tfc && (tfc.input_size != func.input_size() || tfc.output_size != func.output_size())) {
+	std::cout << "The circuit has " << tfc.input_size << " inputs and " << tfc.output_size << " outputs, "
+		  << function_name << " has " << func.input_size() << " and " << func.output_size() << std::endl;
+	exit(1);
+    }
+    auto [e, fn, fp] = tfc.circuit.errors(func);
+    std::cout << tfc.circuit << std::endl;
+    std::cout << tfc.circuit.l() << ' ' << tfc.circuit.d() << ' ' << e << ' ' << fn << ' ' << fp << ' ' << tfc.circuit.quantum_cost() << std::endl;
+    if (tfc.quantum_cost > 0)
+	std::cout << "Quantum cost in the file: " << tfc.quantum_cost << std::endl;
+    if (noise) {
+	auto [noisy_e, noisy_fn, noisy_fp] = noisy_errors(tfc.circuit, func, *noise, shots, seed);
+	std::cout << "Noisy errors: " << noisy_e << ' ' << noisy_fn << ' ' << noisy_fp << std::endl;
+    }
+}
+
+
+// Circuit to start the optimizations from, in TFC or in the text format of the output files
+template<typename Reg_t>
+Circuit<Reg_t> read_initial_circuit(const std::string& path) {
+    std::ifstream is(path);
+    if (!is) {
+	std::cout << "Could not open '" << path << "'" << std::endl;
+	exit(1);
+    }
+    if (std::filesystem::path(path).extension() == ".tfc")
+	return read_tfc<Reg_t>(is).circuit;
+    return Circuit<Reg_t>::deserialize(is);
+}
+
+
+// Print the best circuit of the optimizations of a depth and write it to the output file
+template<typename Reg_t>
+void report_best(const std::vector<OptimizationResult<Reg_t>>& results, unsigned l, unsigned d, int seed, const OptimizerOptions& options, const RunConfig& config,
+		 std::ostream& output_file, const std::string& output_name) {
+    Circuit<Reg_t> best = results[0].best;
+    auto [best_e, best_fn, best_fp] = results[0].errors;
+    for (const auto& result : results) {
+	auto [e, fn, fp] = result.errors;
+	if (e < best_e) {
+	    best = result.best;
+	    best_e = e;
+	    best_fn = fn;
+	    best_fp = fp;
+	}
+    }
+    const unsigned output_size = results[0].output_size;
+
+    std::cout << best << std::endl;
+    std::cout << best.simplified(output_size) << std::endl;
+    std::cout << l << ' ' << d << ' ' << best_e << ' ' << best_fn << ' ' << best_fp << std::endl;
+    if (options.cache_size > 0) {
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	for (const auto& result : results) {
+	    hits += result.cache.first;
+	    misses += result.cache.second;
+	}
+	std::cout << "Fitness cache: " << hits << " hits, " << misses << " misses" << std::endl;
+    }
+    if (options.stop_on_exact || options.plateau > 0 || options.max_evaluations > 0 || options.max_seconds > 0) {
+	unsigned generations = 0;
+	for (const auto& result : results)
+	    generations += result.generations;
+	std::cout << "Generations run: " << generations << " of at most " << results.size() * config.generations_per_gate * d << std::endl;
+    }
+    // Write the best circuit to the output file
+    const unsigned qc = best.simplified(output_size).quantum_cost();
+    best.serialize(output_file);
+    output_file << l << ' ' << d << ' ' << best_e << ' ' << best_fn << ' ' << best_fp << ' ' << qc << '\n';
+    if (config.archive_writer)
+	config.archive_writer->append(best, qc, seed, best_e, best_fn, best_fp);
+    if (config.export_tfc) {
+	std::ofstream tfc_file(output_name + ".d" + std::to_string(d) + ".tfc");
+	write_tfc(tfc_file, best, results[0].input_size, output_size);
+    }
+}
+
+
+#ifdef USE_MPI
+// Results of the optimizations of all the ranks, in rank order
+template<typename Reg_t>
+std::vector<OptimizationResult<Reg_t>> gather_results(const std::vector<OptimizationResult<Reg_t>>& results) {
+    std::ostringstream os;
+    os << results.size() << '\n';
+    for (const auto& result : results) {
+	result.best.serialize(os);
+	auto [e, fn, fp] = result.errors;
+	os << std::setprecision(17) << e << ' ' << fn << ' ' << fp << ' ' << result.cache.first << ' ' << result.cache.second << ' ' << result.generations << '\n';
+    }
+    std::vector<OptimizationResult<Reg_t>> all;
+    for (const auto& data : allgather_strings(os.str(), MPI_COMM_WORLD)) {
+	std::istringstream is(data);
+	size_t n;
+	is >> n;
+	for (size_t i = 0 ; i < n ; ++i) {
+	    OptimizationResult<Reg_t> result;
+	    result.best = Circuit<Reg_t>::deserialize(is);
+	    auto& [e, fn, fp] = result.errors;
+	    is >> e >> fn >> fp >> result.cache.first >> result.cache.second >> result.generations;
+	    result.input_size = results[0].input_size;
+	    result.output_size = results[0].output_size;
+	    all.push_back(result);
+	}
+    }
+    return all;
+}
+#endif
+
+
+// Output file of a seed in a sweep: the seed is appended to the stem of the
+// output name, e.g. 2of5.txt becomes 2of5_07.txt
+std::string seed_output_name(const std::string& output, int seed) {
+    const std::filesystem::path path(output);
+    std::ostringstream name;
+    name << path.stem().string() << '_' << std::setw(2) << std::setfill('0') << seed << path.extension().string();
+    return (path.parent_path() / name.str()).string();
+}
 
+
+// Run the optimizations of every depth for num_seeds consecutive seeds. All
+// (depth, seed, restart) jobs are scheduled dynamically on one team of threads
+// with the deepest, i.e. longest, jobs first, and the best circuit of every
+// (seed, depth) is written to the file of its seed as soon as all its
+// restarts are done. Every job seeds its own RNG, so the results do not
+// depend on the scheduling.
+template<typename Reg_t, typename MutStrat_t>
+void sweep(const TruthTable& func, const std::string& output, int first_seed, unsigned num_seeds, unsigned restarts,
+	   unsigned l, unsigned d_min, unsigned d_max, unsigned d_inc, unsigned S, unsigned F, unsigned b, MutStrat_t& mut_strat, const OptimizerOptions& options,
+	   const RunConfig& config, const Circuit<Reg_t>* initial) {
+    struct Job {
+	unsigned depth_idx;
+	unsigned seed_idx;
+	unsigned restart;
+    };
+    const unsigned num_depths = (d_max - d_min) / d_inc + 1;
+    std::vector<std::set<unsigned>> completed(num_seeds);
+    if (config.checkpoint.resume) {
+	for (unsigned s = 0 ; s < num_seeds ; ++s)
+	    completed[s] = completed_depths(seed_output_name(output, first_seed+s));
+    }
+    std::vector<Job> jobs;
+    for (unsigned i = 0 ; i < num_depths ; ++i) {
+	for (unsigned s = 0 ; s < num_seeds ; ++s) {
+	    if (completed[s].count(d_min + i*d_inc))
+		continue;
+	    for (unsigned r = 0 ; r < restarts ; ++r)
+		jobs.push_back({i, s, r});
+	}
+    }
+    std::stable_sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) { return a.depth_idx > b.depth_idx; });
+
+    std::vector<std::ofstream> output_files(num_seeds);
+    for (unsigned s = 0 ; s < num_seeds ; ++s)
+	output_files[s].open(seed_output_name(output, first_seed+s), config.checkpoint.resume ? std::ios::app : std::ios::trunc);
+    // Results of the restarts of every (seed, depth) and the number of them still running
+    std::vector<std::vector<OptimizationResult<Reg_t>>> results(num_seeds*num_depths, std::vector<OptimizationResult<Reg_t>>(restarts));
+    std::vector<unsigned> remaining(num_seeds*num_depths, restarts);
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (size_t j = 0 ; j < jobs.size() ; ++j) {
+	const Job job = jobs[j];
+	const unsigned d = d_min + job.depth_idx*d_inc;
+	const int seed = first_seed + job.seed_idx;
+	std::seed_seq seq{seed, static_cast<int>(d), static_cast<int>(job.restart)};
+	std::mt19937 rng(seq);
+	const std::string seed_output = seed_output_name(output, seed);
+	auto result = optimize<Reg_t>(func, rng, l, d, S, F, b, mut_strat, options, config, initial, {}, checkpoint_name(seed_output, d, job.restart), seed, job.restart);
+	const unsigned group = job.seed_idx*num_depths + job.depth_idx;
+	#pragma omp critical
+	{
+	    results[group][job.restart] = std::move(result);
+	    if (--remaining[group] == 0) {
+		std::cout << "Seed " << seed << std::endl;
+		report_best(results[group], l, d, seed, options, config, output_files[job.seed_idx], seed_output);
+		output_files[job.seed_idx].flush();
+		results[group].clear();
+		if (config.checkpoint.interval > 0) {
+		    for (unsigned r = 0 ; r < restarts ; ++r)
+			config.checkpoint_writer->remove(checkpoint_name(seed_output, d, r));
+		}
+	    }
+	}
+    }
+}
+
+
+// Run the optimizations of the command line with registers of type Reg_t,
+// which has to hold num_lines bits
+template<typename Reg_t>
+void run(const po::variables_map& vm, const RunConfig& config, int rank, int num_ranks) {
+    const unsigned l = vm["num_lines"].as<unsigned>();
+    const unsigned d_min = vm["min_num_gates"].as<unsigned>();
+    const unsigned d_max = vm["max_num_gates"].as<unsigned>();
+    const unsigned d_inc = vm["num_gates_increment"].as<unsigned>();
+    const unsigned S = vm["num_survivors"].as<unsigned>();
+    const unsigned F = vm["num_offspring"].as<unsigned>();
+    const unsigned b = vm["batch_size"].as<unsigned>();
+    const int optimizations_per_circuit = vm["optimizations_per_circuit"].as<int>();
+    const int seed = vm["seed"].as<int>();
+    const unsigned max_gate_size = vm["max_gate_size"].as<unsigned>();
+    if (max_gate_size == 0) {
+	std::cout << "The gates act on at least 1 line" << std::endl;
+	exit(1);
+    }
+    const bool negative_controls = vm["negative_controls"].as<bool>();
+    const MutationWeights mutation_weights = parse_mutation_weights(vm["mutation_weights"].as<std::string>());
+    OptimizerOptions options;
+    options.incremental_interval = vm["incremental_interval"].as<unsigned>();
+    options.exhaustive = vm["exhaustive"].as<bool>();
+    options.cache_size = vm["cache_size"].as<size_t>();
+    options.species_threads = vm["species_threads"].as<unsigned>();
+    options.rewrite_interval = vm["rewrite_interval"].as<unsigned>();
+    options.adaptive = vm["adaptive"].as<bool>();
+    options.stop_on_exact = vm["stop_on_exact"].as<bool>();
+    options.plateau = vm["plateau"].as<unsigned>();
+    options.max_evaluations = vm["max_evaluations"].as<uint64_t>();
+    options.max_seconds = vm["max_seconds"].as<double>();
+    options.stagnation_limit = vm["stagnation_limit"].as<unsigned>();
+    // The species are evaluated by a team nested in the one running the
+    // optimizations
+    if (options.species_threads > 0)
+	omp_set_max_active_levels(2);
+    
+    std::unique_ptr<Circuit<Reg_t>> initial;
+    if (vm.count("seed_circuit")) {
+	initial = std::make_unique<Circuit<Reg_t>>(read_initial_circuit<Reg_t>(vm["seed_circuit"].as<std::string>()));
+	if (initial->l() != l) {
+	    std::cout << "The seed circuit has " << initial->l() << " lines instead of " << l << std::endl;
+	    exit(1);
+	}
+    }
+
+    // Tabulated once and shared by all the optimizations
+    const TruthTable func = load_function(vm["function"].as<std::string>());
+    if (func.input_size() > l || func.output_size() > l) {
+	std::cout << "The function has " << func.input_size() << " inputs and " << func.output_size() << " outputs, more than the " << l << " lines" << std::endl;
+	exit(1);
+    }
+    // The mutation strategy is only read by the optimizers, which all share it
+    FullyConnectedMutationStrategy<Reg_t> mut_strat(l, max_gate_size, negative_controls, mutation_weights);
+    if (vm.count("seeds")) {
+	// The depths of a sweep run concurrently
+	if (config.warm_start > 0) {
+	    std::cout << "Sweeps do not support warm starts" << std::endl;
+	    exit(1);
+	}
+	sweep<Reg_t>(func, vm["output"].as<std::string>(), seed, vm["seeds"].as<unsigned>(), optimizations_per_circuit,
+		     l, d_min, d_max, d_inc, S, F, b, mut_strat, options, config, initial.get());
+	return;
+    }
+
+    const std::string output = vm["output"].as<std::string>();
+    // Every rank skips the depths rank 0 already wrote
+    std::set<unsigned> completed;
+    if (config.checkpoint.resume && rank == 0)
+	completed = completed_depths(output);
+#ifdef USE_MPI
+    std::ostringstream completed_data;
+    for (unsigned d : completed)
+	completed_data << d << ' ';
+    std::istringstream completed_is(allgather_strings(completed_data.str(), MPI_COMM_WORLD)[0]);
+    for (unsigned d ; completed_is >> d ;)
+	completed.insert(d);
+#endif
+    std::ofstream output_file;
+    if (rank == 0)
+	output_file.open(output, config.checkpoint.resume ? std::ios::app : std::ios::trunc);
+    // The ranks have to migrate in the same order, the optimizations of a
+    // rank then run one after the other
+    bool parallel_optimizations = true;
+#ifdef USE_MPI
+    parallel_optimizations = config.migration.interval == 0 || num_ranks == 1;
+#endif
+    // Circuits found at the previous depth by every optimization of the rank,
+    // none after a resume
+    std::vector<std::vector<Circuit<Reg_t>>> warm(optimizations_per_circuit);
+    for (unsigned d = d_min ; d <= d_max ; d += d_inc) {
+	if (completed.count(d))
+	    continue;
+	std::vector<OptimizationResult<Reg_t>> results(optimizations_per_circuit);
+	#pragma omp parallel for if(parallel_optimizations)
+	for (int i = 0 ; i < optimizations_per_circuit ; ++i) {
+	    // Every optimization seeds its own RNG, so that the depths skipped by
+	    // a resume do not change the others
+	    std::seed_seq seq{seed, rank, static_cast<int>(d), i};
+	    std::mt19937 rng(seq);
+	    results[i] = optimize<Reg_t>(func, rng, l, d, S, F, b, mut_strat, options, config, initial.get(), warm[i], checkpoint_name(output, d, i), seed, i);
+	}
+	for (int i = 0 ; i < optimizations_per_circuit ; ++i)
+	    warm[i] = std::move(results[i].elites);
+#ifdef USE_MPI
+	results = gather_results(results);
+#endif
+	if (rank == 0) {
+	    report_best(results, l, d, seed, options, config, output_file, output);
+	    output_file.flush();
+	}
+	if (config.checkpoint.interval > 0) {
+	    for (int i = 0 ; i < optimizations_per_circuit ; ++i)
+		config.checkpoint_writer->remove(checkpoint_name(output, d, i));
+	}
+    }
+}
+
+
+int main(int argc, char *argv[]) {
     po::options_description desc("Allowed options");
     desc.add_options()
 	("output,o", po::value<std::string>(), "Name of output file")
-	("function,f", po::value<std::string>(), "Function to optimize")
-	("num_lines,l", po::value<unsigned>(), "Number of lines of the circuit")
+	("function,f", po::value<std::string>(), "Function to optimize, built-in or a .pla or .spec truth table file")
+	("num_lines,l", po::value<unsigned>(), "Number of lines of the circuit (at most 128)")
 	("min_num_gates,d", po::value<unsigned>(), "Minumum number of gates")
 	("max_num_gates,D", po::value<unsigned>(), "Maximum number of gates")
 	("num_gates_increment,i", po::value<unsigned>(), "Increment in the number of gates")
@@ -31,10 +613,66 @@ int main(int argc, char *argv[]) {
 	("num_offspring,F", po::value<unsigned>(), "Number of offspring per survivor")
 	("batch_size,b", po::value<unsigned>(), "Number of inputs to test each circuit with")
 	("optimizations_per_circuit,n", po::value<int>(), "Number of optimization passes per circuit")
-	("seed,s", po::value<int>()->default_value(0), "Seed to initialize the RNG with");
+	("seed,s", po::value<int>()->default_value(0), "Seed to initialize the RNG with")
+	("seeds", po::value<unsigned>(), "Run a sweep over this many seeds starting from seed, writing one output file per seed")
+	("checkpoint_interval", po::value<unsigned>()->default_value(0), "Number of generations between snapshots of every optimization (0 disables)")
+	("resume", po::bool_switch(), "Resume an interrupted run from its output files and snapshots")
+	("archive", po::value<std::string>(), "Binary archive to also append the written circuits to")
+	("telemetry", po::value<std::string>(), "File to write statistics of every generation to, in CSV if it ends with .csv and in JSON Lines otherwise")
+	("tfc", po::bool_switch(), "Also write every written circuit to a TFC file named after the output file and its number of gates")
+	("seed_circuit", po::value<std::string>(), "Circuit (TFC or output file format) to start one family of every optimization from")
+	("evaluate", po::value<std::string>(), "Only print the errors and quantum cost of a circuit (TFC or output file format) for the function")
+	("noise", po::value<std::string>(), "Noise model file to also estimate the errors of the evaluated circuit under")
+	("noise_scale", po::value<double>()->default_value(1), "Factor applied to all the errors of the noise model")
+	("shots", po::value<unsigned>()->default_value(1024), "Number of noisy runs of the evaluated circuit per input")
+	("max_gate_size", po::value<unsigned>()->default_value(3), "Maximum number of lines of the gates drawn by the mutations, at least 1")
+	("negative_controls", po::bool_switch(), "Let the mutations draw Toffoli and Fredkin gates with negative controls")
+	("mutation_weights", po::value<std::string>()->default_value("replace=1"), "Relative probabilities of the mutation operators replace, insert, remove, swap, retarget and invert, e.g. replace=4,insert=1,remove=1")
+#ifdef USE_MPI
+	("migration_interval", po::value<unsigned>()->default_value(0), "Number of generations between migrations between the MPI ranks (0 disables)")
+	("migration_size", po::value<unsigned>()->default_value(1), "Number of circuits sent by every rank at each migration")
+	("topology", po::value<std::string>()->default_value("ring"), "Migration topology: ring or complete")
+#endif
+	("incremental_interval", po::value<unsigned>()->default_value(0), "Simulate offspring from parent states cached every this many gates (0 disables)")
+	("exhaustive", po::bool_switch(), "Compute the exact fitness on every possible input instead of sampling batches")
+	("cache_size", po::value<size_t>()->default_value(0), "Number of fitness values to memoize by circuit hash (0 disables)")
+	("species_threads", po::value<unsigned>()->default_value(0), "Number of threads evaluating the species of each generation (0 evaluates them sequentially)")
+	("rewrite_interval", po::value<unsigned>()->default_value(0), "Number of generations between rewrites of the survivors into shorter equivalent circuits (0 disables)")
+	("adaptive", po::bool_switch(), "Adapt the probabilities of the mutation operators, the fraction of random inputs and the batch size to the success of the mutations, starting from the given ones")
+	("generations_per_gate", po::value<unsigned>()->default_value(100), "Maximum number of generations of an optimization per gate of its circuits")
+	("stop_on_exact", po::bool_switch(), "Stop an optimization once a survivor has no wrong output on the full truth table")
+	("plateau", po::value<unsigned>()->default_value(0), "Stop an optimization once its best circuit, evaluated on the full truth table, has not improved for this many generations (0 disables)")
+	("max_evaluations", po::value<uint64_t>()->default_value(0), "Stop an optimization after this many fitness evaluations (0 disables)")
+	("max_seconds", po::value<double>()->default_value(0), "Stop an optimization this many seconds after its start (0 disables)")
+	("warm_start", po::value<unsigned>()->default_value(0), "Seed one family of every optimization from each of this many of the best distinct circuits of the one with the same index at the previous depth, padded with Id gates, the others start from random circuits (0 starts all of them from random circuits)")
+	("stagnation_limit", po::value<unsigned>()->default_value(0), "Every this many generations without improvement of the best circuit, as for --plateau, re-randomize the families whose survivor is less fit than the median one (0 disables)");
     po::variables_map vm;
+#ifdef USE_MPI
+    MPI_Init(&argc, &argv);
+    int rank, num_ranks;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_ranks);
+#else
+    const int rank = 0;
+    const int num_ranks = 1;
+#endif
     po::store(po::parse_command_line(argc, argv, desc), vm);
 
+    if (vm.count("evaluate") && vm.count("function")) {
+	std::unique_ptr<NoiseModel> noise;
+	if (vm.count("noise")) {
+	    noise = std::make_unique<NoiseModel>(load_noise_model(vm["noise"].as<std::string>()));
+	    noise->scale = vm["noise_scale"].as<double>();
+	}
+	// The widest registers hold circuits of any supported size
+	if (rank == 0)
+	    evaluate<unsigned __int128>(vm["function"].as<std::string>(), vm["evaluate"].as<std::string>(), noise.get(), vm["shots"].as<unsigned>(), vm["seed"].as<int>());
+#ifdef USE_MPI
+	MPI_Finalize();
+#endif
+	return 0;
+    }
+
     if (vm.count("output") == 0 ||
 	    vm.count("function") == 0 ||
 	    vm.count("num_lines") == 0 ||
@@ -49,102 +687,39 @@ int main(int argc, char *argv[]) {
 	exit(1);
     }
 
+    // The narrowest registers holding all the lines pack the most registers
+    // per cache line and SIMD lane
     const unsigned l = vm["num_lines"].as<unsigned>();
-    const unsigned d_min = vm["min_num_gates"].as<unsigned>();
-    const unsigned d_max = vm["max_num_gates"].as<unsigned>();
-    const unsigned d_inc = vm["num_gates_increment"].as<unsigned>();
-    const unsigned S = vm["num_survivors"].as<unsigned>();
-    const unsigned F = vm["num_offspring"].as<unsigned>();
-    const unsigned b = vm["batch_size"].as<unsigned>();
-    const int optimizations_per_circuit = vm["optimizations_per_circuit"].as<int>();
-    const int seed = vm["seed"].as<int>();
-    
-    unsigned num_threads;
-    #pragma omp parallel
-    {
-	#pragma omp master
-	num_threads = omp_get_num_threads();
+    if (l > 128) {
+	std::cout << "At most 128 lines are supported" << std::endl;
+	exit(1);
+    }
+    if (vm.count("seeds") && num_ranks > 1) {
+	// Checked by every rank before any MPI work, so that they all shut down
+	if (rank == 0)
+	    std::cout << "Sweeps run on a single rank" << std::endl;
+#ifdef USE_MPI
+	MPI_Finalize();
+#endif
+	return 1;
     }
-    std::vector<std::mt19937> rngs(num_threads);
-    std::vector<FullyConnectedMutationStrategy<Reg_t>> mut_strats(num_threads);
-    #pragma omp parallel
     {
-	const int tidx = omp_get_thread_num();
-	rngs[tidx] = std::mt19937(seed+tidx);
-	mut_strats[tidx] = FullyConnectedMutationStrategy<Reg_t>(l);
+	// The writers of the config finish before MPI does
+	const RunConfig config = read_run_config(vm, rank, num_ranks);
+	if (l <= 8)
+	    run<uint8_t>(vm, config, rank, num_ranks);
+	else if (l <= 16)
+	    run<uint16_t>(vm, config, rank, num_ranks);
+	else if (l <= 32)
+	    run<uint32_t>(vm, config, rank, num_ranks);
+	else if (l <= 64)
+	    run<uint64_t>(vm, config, rank, num_ranks);
+	else
+	    run<unsigned __int128>(vm, config, rank, num_ranks);
     }
 
-    std::ofstream output_file;
-    output_file.open(vm["output"].as<std::string>());
-    unsigned output_size;
-    for (unsigned d = d_min ; d <= d_max ; d += d_inc) {
-	std::vector<Circuit<Reg_t>> best_per_optim(optimizations_per_circuit);
-	std::vector<std::tuple<double, double, double>> e_per_optim(optimizations_per_circuit);
-	#pragma omp parallel for
-	for (int i = 0 ; i < optimizations_per_circuit ; ++i) {
-	    const int tidx = omp_get_thread_num();
-	    using MS_t = FullyConnectedMutationStrategy<Reg_t>;
-	    #define DO_OPTIMIZATION(fn) Optimizer<Reg_t, fn, MS_t> optimizer(rngs[tidx], l, d, S, F, mut_strats[tidx]);		\
-					optimizer.optimize(rngs[tidx], 100*d, 0.5, b);						\
-					best_per_optim[i] = optimizer.compute_best();						\
-					e_per_optim[i] = best_per_optim[i].errors(fn{});					\
-					output_size = fn::output_size;
-	    const std::string function_name = vm["function"].as<std::string>();
-	    if (function_name == "2of5") {
-		DO_OPTIMIZATION(Func2of5);
-	    }
-	    else if (function_name == "4mod5") {
-		DO_OPTIMIZATION(Func4mod5);
-	    }
-	    else if (function_name == "5mod5") {
-		DO_OPTIMIZATION(Func5mod5);
-	    }
-	    else if (function_name == "6sym") {
-		DO_OPTIMIZATION(Func6sym);
-	    }
-	    else if (function_name == "9sym") {
-		DO_OPTIMIZATION(Func9sym);
-	    }
-	    else if (function_name == "Id") {
-		DO_OPTIMIZATION(FuncId);
-	    }
-	    else if (function_name == "Xor5") {
-		DO_OPTIMIZATION(FuncXor5);
-	    }
-	    else if (function_name == "NthPrime3") {
-		DO_OPTIMIZATION(FuncNthPrime3);
-	    }
-	    else if (function_name == "NthPrime4") {
-		DO_OPTIMIZATION(FuncNthPrime4);
-	    }
-	    else {
-		std::cout << "Unknown function: '" << function_name << "'" << std::endl;
-		exit(1);
-	    }
-	    #undef DO_OPTIMIZATION
-	}
-	Circuit<Reg_t> best;
-	double best_e = 1;
-	double best_fn;
-	double best_fp;
-	for (int i = 0 ; i < optimizations_per_circuit ; ++i) {
-	    auto [e, fn, fp] = e_per_optim[i];
-	    if (e < best_e) {
-		best = best_per_optim[i];
-		best_e = e;
-		best_fn = fn;
-		best_fp = fp;
-	    }
-	}
-
-	std::cout << best << std::endl;
-	std::cout << best.simplified(output_size) << std::endl;
-	std::cout << l << ' ' << d << ' ' << best_e << ' ' << best_fn << ' ' << best_fp << std::endl;
-	// Write the best circuit to the output file
-	best.serialize(output_file);
-	output_file << l << ' ' << d << ' ' << best_e << ' ' << best_fn << ' ' << best_fp << ' ' << best.simplified(output_size).quantum_cost() << '\n';
-	best.extend(d_inc);
-    }
-    
+#ifdef USE_MPI
+    MPI_Finalize();
+#endif
     return 0;
 }
@@ -0,0 +1,176 @@
+#ifndef COMPILED_CIRCUIT_HH_
+#define COMPILED_CIRCUIT_HH_
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include <ranges>
+#include <type_traits>
+#include "bits.hh"
+#include "instruction.hh"
+#include "bit_sliced_registers.hh"
+#include "simd_kernels.hh"
+
+
+// Every compiled operation is applied to a register iff (reg ^ neg) & ctrl ==
+// ctrl, i.e. its controls are set except the negative ones which are cleared.
+// Toggles flip all their target bits, swaps exchange their two target bits.
+// The operations are distinguished by their number of controls so that the
+// simulators do not have to inspect the masks to pick a kernel, operations
+// with negative controls are always mcX or mcSwap.
+enum class Op : uint8_t { X, cX, ccX, mcX, Swap, cSwap, mcSwap };
+
+
+// Flat structure-of-arrays form of a circuit used for simulation. Id gates are
+// dropped, consecutive toggles sharing their controls are fused into a single
+// multi-target toggle and adjacent gates cancelling each other are removed.
+template<typename Reg_t>
+class CompiledCircuit {
+public:
+    CompiledCircuit() = default;
+    CompiledCircuit(const CompiledCircuit&) = default;
+    CompiledCircuit(CompiledCircuit&&) = default;
+    CompiledCircuit& operator=(const CompiledCircuit&) = default;
+    CompiledCircuit& operator=(CompiledCircuit&&) = default;
+
+    template<typename Circuit_t>
+    explicit CompiledCircuit(const Circuit_t& circuit) { compile(circuit, 0, circuit.d()); }
+
+    template<typename Circuit_t>
+    CompiledCircuit(const Circuit_t& circuit, unsigned first, unsigned last) { compile(circuit, first, last); }
+
+    size_t size() const { return n_; }
+    Op op(size_t i) const { return op_[i]; }
+    Reg_t ctrl(size_t i) const { return ctrl_[i]; }
+    Reg_t neg(size_t i) const { return neg_[i]; }
+    Reg_t target(size_t i) const { return target_[i]; }
+
+    // Compile the gates [first, last) of the circuit, reusing the storage
+    template<typename Circuit_t>
+    void compile(const Circuit_t& circuit, unsigned first, unsigned last) {
+	static constexpr unsigned first_op[] = {0, 0, 0, 0, static_cast<unsigned>(Op::Swap), static_cast<unsigned>(Op::Swap), 0, static_cast<unsigned>(Op::Swap)};
+	static constexpr unsigned max_ctrls[] = {0, 3, 3, 3, 2, 2, 3, 2};
+	if (op_.size() < last-first) {
+	    op_.resize(last-first);
+	    ctrl_.resize(last-first);
+	    neg_.resize(last-first);
+	    target_.resize(last-first);
+	}
+	n_ = 0;
+	for (unsigned i = first ; i < last ; ++i) {
+	    const auto& inst = circuit[i];
+	    const unsigned g = static_cast<unsigned>(inst.type());
+	    const Reg_t target = inst.target();
+	    const Reg_t ctrl = inst.ctrl();
+	    const Reg_t neg = inst.neg();
+	    if (n_ > 0 && ctrl_[n_-1] == ctrl && neg_[n_-1] == neg && fuse(g, ctrl, target))
+		continue;
+	    // Written unconditionally and only kept for actual gates, which
+	    // avoids mispredicted branches on the random gate types
+	    op_[n_] = Op(first_op[g] + std::min<unsigned>(bits::popcount(ctrl) + 3*(neg != 0), max_ctrls[g]));
+	    ctrl_[n_] = ctrl;
+	    neg_[n_] = neg;
+	    target_[n_] = target;
+	    n_ += g != static_cast<unsigned>(Gate::Id) && (first_op[g] < static_cast<unsigned>(Op::Swap) || (target & (target-1)));
+	}
+    }
+
+    template<typename Iterable>
+    void run(Iterable& regs) const {
+	if constexpr (std::ranges::contiguous_range<Iterable> && std::is_same_v<std::ranges::range_value_t<Iterable>, Reg_t>) {
+	    run(std::ranges::data(regs), std::ranges::size(regs));
+	}
+	else {
+	    for (size_t i = 0 ; i < n_ ; ++i) {
+		for (auto& reg : regs) {
+		    if (((reg ^ neg_[i]) & ctrl_[i]) != ctrl_[i])
+			continue;
+		    if (op_[i] < Op::Swap || ((reg & target_[i]) != 0 && (reg & target_[i]) != target_[i]))
+			reg ^= target_[i];
+		}
+	    }
+	}
+    }
+
+    void run(Reg_t* regs, size_t n) const {
+	for (size_t i = 0 ; i < n_ ; ++i) {
+	    if (op_[i] < Op::Swap) {
+		simd::toggle(regs, n, ctrl_[i], neg_[i], target_[i]);
+	    }
+	    else {
+		const Reg_t t1 = target_[i] & -target_[i];
+		simd::swap(regs, n, ctrl_[i], neg_[i], t1, Reg_t(target_[i] ^ t1));
+	    }
+	}
+    }
+
+    template<typename Word_t>
+    void run(BitSlicedRegisters<Word_t>& regs) const {
+	for (size_t i = 0 ; i < n_ ; ++i) {
+	    const Reg_t ctrl = ctrl_[i];
+	    Reg_t target = target_[i];
+	    switch (op_[i]) {
+		case Op::X:
+		    for (; target ; target &= target-1)
+			regs.apply_X(bits::countr_zero(target));
+		    break;
+		case Op::cX:
+		    for (; target ; target &= target-1)
+			regs.apply_cX(bits::countr_zero(target), bits::countr_zero(ctrl));
+		    break;
+		case Op::ccX:
+		    for (; target ; target &= target-1)
+			regs.apply_ccX(bits::countr_zero(target), bits::countr_zero(ctrl), bits::countr_zero(Reg_t(ctrl & (ctrl-1))));
+		    break;
+		case Op::Swap:
+		    regs.apply_Swap(bits::countr_zero(target), bits::countr_zero(Reg_t(target & (target-1))));
+		    break;
+		case Op::cSwap:
+		    regs.apply_cSwap(bits::countr_zero(target), bits::countr_zero(Reg_t(target & (target-1))), bits::countr_zero(ctrl));
+		    break;
+		case Op::mcX:
+		    regs.apply_toggle(ctrl, neg_[i], target);
+		    break;
+		case Op::mcSwap:
+		    regs.apply_swap(ctrl, neg_[i], target);
+		    break;
+		default:
+		    break;
+	    }
+	}
+    }
+
+private:
+    // The arrays are only grown, the first n_ entries hold the operations
+    std::vector<Op> op_;
+    std::vector<Reg_t> ctrl_;
+    std::vector<Reg_t> neg_;
+    std::vector<Reg_t> target_;
+    size_t n_ = 0;
+
+    // Merge a gate into the previous operation with the same controls and
+    // negative controls if possible
+    bool fuse(unsigned g, Reg_t ctrl, Reg_t target) {
+	if (g == static_cast<unsigned>(Gate::Id))
+	    return false;
+	if (g == static_cast<unsigned>(Gate::Swap) || g == static_cast<unsigned>(Gate::cSwap) || g == static_cast<unsigned>(Gate::mcSwap)) {
+	    // Swapping the same bits twice is the identity
+	    if (op_[n_-1] < Op::Swap || target_[n_-1] != target || (target & ctrl))
+		return false;
+	    --n_;
+	    return true;
+	}
+	// Toggles with the same controls commute and can be merged as long as
+	// none of them modifies the controls
+	if (op_[n_-1] >= Op::Swap || ((target | target_[n_-1]) & ctrl))
+	    return false;
+	target_[n_-1] ^= target;
+	if (target_[n_-1] == 0)
+	    --n_;
+	return true;
+    }
+};
+
+
+#endif // COMPILED_CIRCUIT_HH_
@@ -1,5 +1,6 @@
 import qiskit
 import copy
+import subprocess
 import qc_properties
 
 
@@ -61,3 +62,15 @@ def reduce_noise(noise_model, factor):
         else:
             raise RuntimeError('Unknown error type')
     return qiskit.providers.aer.noise.NoiseModel.from_dict(d)
+
+
+
+# Error rates of the circuit in a file (TFC or optimizer output format) under
+# the classical noise model of noise_file, scaled by noise_scale, simulated by
+# the optimizer. Much faster than compute_error_rates.
+def native_error_rates(circuit_file, function_name, noise_scale=1, shots=1024, noise_file='noise/fake_melbourne.txt', optimizer='./optim.out'):
+    output = subprocess.run([optimizer, '-f', function_name, '--evaluate', circuit_file, '--noise', noise_file,
+                             '--noise_scale', str(noise_scale), '--shots', str(shots)],
+                            check=True, capture_output=True, text=True).stdout
+    e, fn, fp = map(float, output.splitlines()[-1].split(':')[1].split())
+    return e, fn, fp
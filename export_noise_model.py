@@ -0,0 +1,30 @@
+#!/usr/bin/env python3
+
+# Write the classical noise model used by the --noise option of optim.out from
+# the calibration of the backend of qc_properties.py
+
+import sys
+import numpy as np
+import qc_properties
+
+
+props = qc_properties.backend.properties()
+num_qubits = qc_properties.backend.configuration().n_qubits
+
+cx_errors = [props.gate_error('cx', g.qubits) for g in props.gates if g.gate == 'cx']
+u3_errors = [props.gate_error('u3', g.qubits) for g in props.gates if g.gate == 'u3']
+id_errors = [props.gate_error('id', g.qubits) for g in props.gates if g.gate == 'id']
+
+with open(sys.argv[1] if len(sys.argv) > 1 else 'noise/fake_melbourne.txt', 'w') as f:
+    f.write('# Classical noise model of the backend of qc_properties.py, see noisy_simulator.hh\n')
+    f.write('# for the format. Written by export_noise_model.py.\n\n')
+    f.write('# Average CNOT error, one unit of quantum cost is one CNOT. The errors are those\n')
+    f.write('# of the calibration, which noisy_simulator.hh converts to flip probabilities.\n')
+    f.write('cost {:.4f}\n'.format(np.mean(cx_errors)))
+    f.write('# Average single-qubit gate errors\n')
+    f.write('gate Id {:.4f}\n'.format(np.mean(id_errors)))
+    f.write('gate X {:.4f}\n'.format(np.mean(u3_errors)))
+    f.write('# Readout errors of qubits 0 to {}\n'.format(num_qubits-1))
+    for q in range(num_qubits):
+        p = props.readout_error(q)
+        f.write('readout {:.4f} {:.4f}\n'.format(p, p))
@@ -0,0 +1,167 @@
+#ifndef FITNESS_CACHE_HH_
+#define FITNESS_CACHE_HH_
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include "checkpoint.hh"
+
+
+// Fixed capacity map from circuit hashes to fitness values evicting the least
+// recently used entry when full. All storage is allocated on construction.
+class FitnessCache {
+public:
+    FitnessCache(size_t capacity=0) : nodes_(capacity), table_(table_size(capacity), empty), head_(none), tail_(none), size_(0) {}
+    FitnessCache(const FitnessCache&) = default;
+    FitnessCache(FitnessCache&&) = default;
+    FitnessCache& operator=(const FitnessCache&) = default;
+    FitnessCache& operator=(FitnessCache&&) = default;
+
+    size_t capacity() const { return nodes_.size(); }
+    size_t size() const { return size_; }
+    uint64_t hits() const { return hits_; }
+    uint64_t misses() const { return misses_; }
+
+    // Returns true and stores the fitness in value if the key is cached
+    bool lookup(uint64_t key, double& value) {
+	const size_t slot = find(key);
+	if (table_[slot] == empty) {
+	    ++misses_;
+	    return false;
+	}
+	++hits_;
+	const uint32_t n = table_[slot];
+	unlink(n);
+	push_front(n);
+	value = nodes_[n].value;
+	return true;
+    }
+
+    void insert(uint64_t key, double value) {
+	if (capacity() == 0)
+	    return;
+	size_t slot = find(key);
+	if (table_[slot] != empty) {
+	    nodes_[table_[slot]].value = value;
+	    return;
+	}
+	uint32_t n;
+	if (size_ < capacity()) {
+	    n = size_++;
+	}
+	else {
+	    // Reuse the least recently used node
+	    n = tail_;
+	    unlink(n);
+	    erase_slot(find(nodes_[n].key));
+	    slot = find(key);
+	}
+	nodes_[n].key = key;
+	nodes_[n].value = value;
+	table_[slot] = n;
+	push_front(n);
+    }
+
+    void save(std::ostream& os) const {
+	snapshot::write(os, nodes_);
+	snapshot::write(os, table_);
+	snapshot::write(os, head_);
+	snapshot::write(os, tail_);
+	snapshot::write(os, size_);
+	snapshot::write(os, hits_);
+	snapshot::write(os, misses_);
+    }
+
+    void load(std::istream& is) {
+	snapshot::read(is, nodes_);
+	snapshot::read(is, table_);
+	snapshot::read(is, head_);
+	snapshot::read(is, tail_);
+	snapshot::read(is, size_);
+	snapshot::read(is, hits_);
+	snapshot::read(is, misses_);
+    }
+
+    void clear() {
+	std::fill(table_.begin(), table_.end(), empty);
+	head_ = tail_ = none;
+	size_ = 0;
+    }
+
+private:
+    static constexpr uint32_t empty = std::numeric_limits<uint32_t>::max();
+    static constexpr uint32_t none = std::numeric_limits<uint32_t>::max();
+
+    struct Node {
+	uint64_t key;
+	double value;
+	uint32_t prev;
+	uint32_t next;
+    };
+
+    // Nodes form a doubly linked list in the order of their last use, the
+    // open addressing table maps keys to nodes
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> table_;
+    uint32_t head_;
+    uint32_t tail_;
+    uint32_t size_;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+
+    static size_t table_size(size_t capacity) {
+	size_t n = 1;
+	while (n < 2*capacity)
+	    n <<= 1;
+	return n;
+    }
+
+    size_t mask() const { return table_.size() - 1; }
+
+    // Slot holding the key or the empty slot where it would be inserted
+    size_t find(uint64_t key) const {
+	size_t slot = key & mask();
+	while (table_[slot] != empty && nodes_[table_[slot]].key != key)
+	    slot = (slot + 1) & mask();
+	return slot;
+    }
+
+    // Remove a slot and shift back the following entries of its probe sequence
+    void erase_slot(size_t slot) {
+	table_[slot] = empty;
+	for (size_t next = (slot + 1) & mask() ; table_[next] != empty ; next = (next + 1) & mask()) {
+	    const size_t home = nodes_[table_[next]].key & mask();
+	    if (((next - home) & mask()) >= ((next - slot) & mask())) {
+		table_[slot] = table_[next];
+		table_[next] = empty;
+		slot = next;
+	    }
+	}
+    }
+
+    void unlink(uint32_t n) {
+	if (nodes_[n].prev != none)
+	    nodes_[nodes_[n].prev].next = nodes_[n].next;
+	else
+	    head_ = nodes_[n].next;
+	if (nodes_[n].next != none)
+	    nodes_[nodes_[n].next].prev = nodes_[n].prev;
+	else
+	    tail_ = nodes_[n].prev;
+    }
+
+    void push_front(uint32_t n) {
+	nodes_[n].prev = none;
+	nodes_[n].next = head_;
+	if (head_ != none)
+	    nodes_[head_].prev = n;
+	head_ = n;
+	if (tail_ == none)
+	    tail_ = n;
+    }
+};
+
+
+#endif // FITNESS_CACHE_HH_
@@ -1,7 +1,7 @@
 #ifndef FUNCTIONS_HH_
 #define FUNCTIONS_HH_
 
-#include <bit>
+#include "bits.hh"
 
 
 struct Func2of5 {
@@ -9,7 +9,7 @@ struct Func2of5 {
     static constexpr unsigned output_size = 1;
 
     template<typename Reg_t>
-    static Reg_t func_eval(Reg_t reg) { return std::popcount(reg) == 2 ? 1 : 0; }
+    static Reg_t func_eval(Reg_t reg) { return bits::popcount(reg) == 2 ? 1 : 0; }
 };
 
 
@@ -37,7 +37,7 @@ struct Func6sym {
 
     template<typename Reg_t>
     static Reg_t func_eval(Reg_t reg) {
-	const auto pcnt = std::popcount(reg);
+	const auto pcnt = bits::popcount(reg);
 	return (pcnt >= 2 && pcnt <= 4) ? 1 : 0;
     }
 };
@@ -49,7 +49,7 @@ struct Func9sym {
 
     template<typename Reg_t>
     static Reg_t func_eval(Reg_t reg) {
-	const auto pcnt = std::popcount(reg);
+	const auto pcnt = bits::popcount(reg);
 	return (pcnt >= 3 && pcnt <= 6) ? 1 : 0;
     }
 };
@@ -69,7 +69,7 @@ struct FuncXor5 {
     static constexpr unsigned output_size = 1;
 
     template<typename Reg_t>
-    static Reg_t func_eval(Reg_t reg) { return std::popcount(reg) % 2; }
+    static Reg_t func_eval(Reg_t reg) { return bits::popcount(reg) % 2; }
 };
 
 
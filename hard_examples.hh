@@ -0,0 +1,131 @@
+#ifndef HARD_EXAMPLES_HH_
+#define HARD_EXAMPLES_HH_
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include "alias_table.hh"
+#include "checkpoint.hh"
+
+
+// Failure count of every input of the truth table. The wrong output bits of a
+// generation are added to the halved counts of the previous ones, so that the
+// inputs that keep failing weigh the most and the others are forgotten, and
+// the inputs with a nonzero count are drawn with a probability proportional
+// to it in constant time. The memory is bounded by the number of inputs and
+// reused from one generation to the next.
+template<typename Reg_t>
+class HardExamples {
+public:
+    // Number of wrong output bits of a circuit on an input
+    struct Fail {
+	Reg_t input;
+	uint32_t count;
+    };
+
+    HardExamples() = default;
+
+    explicit HardExamples(size_t input_count) : counts_(input_count, 0), pending_(input_count, 0) {}
+
+    // Number of inputs that can be drawn
+    size_t size() const { return active_.size(); }
+
+    template<typename Rng_t>
+    Reg_t draw(Rng_t& rng) const { return active_[table_(rng)]; }
+
+    // Count the fails of the running generation, which are only drawn after
+    // the next update
+    void add(const Fail& fail) {
+	const size_t k = static_cast<size_t>(fail.input);
+	if (counts_[k] == 0 && pending_[k] == 0)
+	    added_.push_back(fail.input);
+	pending_[k] += fail.count;
+    }
+
+    void add(const std::vector<Fail>& fails) {
+	for (const auto& fail : fails)
+	    add(fail);
+    }
+
+    // Sum the counts of the fails on the same input, leaving one fail per
+    // input in increasing order
+    static void merge(std::vector<Fail>& fails) {
+	std::sort(fails.begin(), fails.end(), [](const Fail& a, const Fail& b) { return a.input < b.input; });
+	size_t kept = 0;
+	for (size_t i = 0 ; i < fails.size() ; ++i) {
+	    if (kept > 0 && fails[kept-1].input == fails[i].input)
+		fails[kept-1].count += fails[i].count;
+	    else
+		fails[kept++] = fails[i];
+	}
+	fails.resize(kept);
+    }
+
+    // Fold the counts of the running generation into the table
+    void update() {
+	// The inputs are kept sorted so that the table does not depend on the
+	// order of the fails
+	std::sort(added_.begin(), added_.end());
+	const size_t n = active_.size();
+	active_.insert(active_.end(), added_.begin(), added_.end());
+	std::inplace_merge(active_.begin(), active_.begin() + n, active_.end());
+	added_.clear();
+	size_t kept = 0;
+	for (Reg_t input : active_) {
+	    const size_t k = static_cast<size_t>(input);
+	    counts_[k] = (counts_[k] >> 1) + pending_[k];
+	    pending_[k] = 0;
+	    if (counts_[k] > 0)
+		active_[kept++] = input;
+	}
+	active_.resize(kept);
+	build_table();
+    }
+
+    void save(std::ostream& os) const {
+	std::vector<uint32_t> counts(active_.size());
+	for (size_t i = 0 ; i < active_.size() ; ++i)
+	    counts[i] = counts_[static_cast<size_t>(active_[i])];
+	snapshot::write(os, active_);
+	snapshot::write(os, counts);
+    }
+
+    void load(std::istream& is) {
+	for (Reg_t input : active_)
+	    counts_[static_cast<size_t>(input)] = 0;
+	std::vector<uint32_t> counts;
+	snapshot::read(is, active_);
+	snapshot::read(is, counts);
+	if (!is || counts.size() != active_.size()) {
+	    active_.clear();
+	    return;
+	}
+	for (size_t i = 0 ; i < active_.size() ; ++i)
+	    counts_[static_cast<size_t>(active_[i])] = counts[i];
+	build_table();
+    }
+
+private:
+    std::vector<uint32_t> counts_;
+    // Counts of the running generation and the inputs they added
+    std::vector<uint32_t> pending_;
+    std::vector<Reg_t> added_;
+    // Inputs with a nonzero count in increasing order and their weights
+    std::vector<Reg_t> active_;
+    std::vector<double> weights_;
+    AliasTable table_;
+
+    void build_table() {
+	if (active_.empty())
+	    return;
+	weights_.resize(active_.size());
+	for (size_t i = 0 ; i < active_.size() ; ++i)
+	    weights_[i] = counts_[static_cast<size_t>(active_[i])];
+	table_.build(weights_);
+    }
+};
+
+
+#endif // HARD_EXAMPLES_HH_
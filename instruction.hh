@@ -2,23 +2,73 @@
 #define INSTRUCTION_HH_
 
 #include <cstdint>
+#include <climits>
 #include <array>
 #include <iostream>
 #include <iomanip>
 #include <string>
 #include <sstream>
 #include <cassert>
+#include <algorithm>
+#include <tuple>
+#include <ranges>
+#include <type_traits>
+#include "bits.hh"
+#include "bit_sliced_registers.hh"
+#include "simd_kernels.hh"
 
 
-enum class Gate { Id, X, cX, ccX, Swap, cSwap };
+// mcX and mcSwap are Toffoli and Fredkin gates with any number of controls,
+// each of which can be positive or negative
+enum class Gate { Id, X, cX, ccX, Swap, cSwap, mcX, mcSwap };
+
+
+// splitmix64 finalizer, also used to hash gates and circuits
+inline uint64_t splitmix64(uint64_t z) {
+    z += 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+
+// Quantum cost of a Toffoli gate with n controls and no ancilla line, as in
+// the tables of RevLib: 1, 1, 5, 13, 29, 61, ... A Fredkin gate with n
+// controls costs a Toffoli gate with n+1 controls and 2 CNOTs.
+inline unsigned toffoli_cost(unsigned n) {
+    if (n < 2)
+	return 1;
+    return n < 31 ? (2u << n) - 3 : UINT_MAX;
+}
 
 
 template<typename Reg_t>
 class Instruction {
 public:
-    Instruction(Gate type, unsigned arg0, unsigned arg1=0, unsigned arg2=0)
-	: type_(type),
-	  args_{Reg_t(1)<<arg0, Reg_t(1)<<arg1, Reg_t(1)<<arg2} {}
+    // Fixed gate on the given lines: cX and ccX flip arg0 controlled by arg1
+    // and arg2, Swap exchanges arg0 and arg1 and cSwap is controlled by arg2
+    Instruction(Gate type, unsigned arg0, unsigned arg1=0, unsigned arg2=0) : type_(type), target_(Reg_t(1)<<arg0), ctrl_(0), neg_(0) {
+	assert(type_ != Gate::mcX && type_ != Gate::mcSwap);
+	if (type_ == Gate::Swap || type_ == Gate::cSwap)
+	    target_ |= Reg_t(1)<<arg1;
+	if (type_ == Gate::cX || type_ == Gate::ccX)
+	    ctrl_ |= Reg_t(1)<<arg1;
+	if (type_ == Gate::ccX || type_ == Gate::cSwap)
+	    ctrl_ |= Reg_t(1)<<arg2;
+    }
+
+    // Toffoli gate if target has one line and Fredkin gate if it has two,
+    // controlled by the lines in ctrl of which those in neg are negative. The
+    // type is the simplest one able to represent the gate.
+    Instruction(Reg_t target, Reg_t ctrl, Reg_t neg=0) : target_(target), ctrl_(ctrl), neg_(neg) {
+	assert(target && !(target & ctrl) && !(neg & ~ctrl) && bits::popcount(target) <= 2);
+	const unsigned nc = bits::popcount(ctrl);
+	if (bits::popcount(target) == 1)
+	    type_ = neg || nc > 2 ? Gate::mcX : Gate(static_cast<unsigned>(Gate::X) + nc);
+	else
+	    type_ = neg || nc > 1 ? Gate::mcSwap : Gate(static_cast<unsigned>(Gate::Swap) + nc);
+    }
+
     Instruction() = default;
     Instruction(const Instruction&) = default;
     Instruction(Instruction&&) = default;
@@ -26,57 +76,130 @@ public:
     Instruction& operator=(Instruction&&) = default;
 
     Gate type() const { return type_; }
-    const std::array<Reg_t, 3>& args() const { return args_; }
+    // Line of a toggle or both lines of a swap
+    Reg_t target() const { return target_; }
+    // All the controls and the negative ones among them
+    Reg_t ctrl() const { return ctrl_; }
+    Reg_t neg() const { return neg_; }
+    bool is_swap() const { return type_ == Gate::Swap || type_ == Gate::cSwap || type_ == Gate::mcSwap; }
 
-    template<typename Iterable>
-    void apply(Iterable& regs) const {
+    // Identifies the operation of the gate: Id gates share one key and
+    // interchangeable arguments are ordered. The keys of the fixed gates fit
+    // in 32 bits, those of the multi-controlled gates hash their masks and
+    // have their highest bit set.
+    uint64_t key() const {
+	unsigned a0 = line(target_);
+	unsigned a1 = 0;
+	unsigned a2 = 0;
 	switch (type_) {
 	    case Gate::Id:
-		for (auto& reg : regs) apply_Id(reg);
-		break;
-	    case Gate::X:
-		for (auto& reg : regs) apply_X(reg);
-		break;
+		return 0;
 	    case Gate::cX:
-		for (auto& reg : regs) apply_cX(reg);
+		a1 = line(ctrl_);
 		break;
 	    case Gate::ccX:
-		for (auto& reg : regs) apply_ccX(reg);
+		a1 = line(ctrl_);
+		a2 = last_line(ctrl_);
 		break;
 	    case Gate::Swap:
-		for (auto& reg : regs) apply_Swap(reg);
+		a1 = last_line(target_);
 		break;
 	    case Gate::cSwap:
-		for (auto& reg : regs) apply_cSwap(reg);
+		a1 = last_line(target_);
+		a2 = line(ctrl_);
 		break;
+	    case Gate::mcX:
+	    case Gate::mcSwap: {
+		uint64_t h = static_cast<uint64_t>(type_);
+		for (const Reg_t mask : {target_, ctrl_, neg_}) {
+		    h = splitmix64(h ^ static_cast<uint64_t>(mask));
+		    if constexpr (bits::is_wide<Reg_t>)
+			h = splitmix64(h ^ static_cast<uint64_t>(mask >> 64));
+		}
+		return h | (uint64_t(1) << 63);
+	    }
 	    default:
 		break;
 	}
+	return static_cast<uint32_t>(type_) | (a0 << 8) | (a1 << 16) | (a2 << 24);
     }
 
-    unsigned quantum_cost() const {
-	switch(type_) {
+    template<typename Iterable>
+    void apply(Iterable& regs) const {
+	if constexpr (std::ranges::contiguous_range<Iterable> && std::is_same_v<std::ranges::range_value_t<Iterable>, Reg_t>) {
+	    apply(std::ranges::data(regs), std::ranges::size(regs));
+	    return;
+	}
+	if (type_ == Gate::Id)
+	    return;
+	if (is_swap()) {
+	    for (auto& reg : regs) apply_swap(reg);
+	}
+	else {
+	    for (auto& reg : regs) apply_toggle(reg);
+	}
+    }
+
+    void apply(Reg_t* regs, size_t n) const {
+	if (type_ == Gate::Id)
+	    return;
+	if (!is_swap()) {
+	    simd::toggle(regs, n, ctrl_, neg_, target_);
+	}
+	else if (target_ & (target_-1)) {
+	    const Reg_t t1 = target_ & -target_;
+	    simd::swap(regs, n, ctrl_, neg_, t1, Reg_t(target_ ^ t1));
+	}
+    }
+
+    template<typename Word_t>
+    void apply(BitSlicedRegisters<Word_t>& regs) const {
+	switch (type_) {
 	    case Gate::Id:
-		return 0;
+		break;
 	    case Gate::X:
+		regs.apply_X(line(target_));
+		break;
 	    case Gate::cX:
-		return 1;
+		regs.apply_cX(line(target_), line(ctrl_));
+		break;
 	    case Gate::ccX:
-		return 5;
+		regs.apply_ccX(line(target_), line(ctrl_), last_line(ctrl_));
+		break;
 	    case Gate::Swap:
-		return 3;
+		regs.apply_Swap(line(target_), last_line(target_));
+		break;
 	    case Gate::cSwap:
-		return 7;
+		regs.apply_cSwap(line(target_), last_line(target_), line(ctrl_));
+		break;
+	    case Gate::mcX:
+		regs.apply_toggle(ctrl_, neg_, target_);
+		break;
+	    case Gate::mcSwap:
+		regs.apply_swap(ctrl_, neg_, target_);
+		break;
 	    default:
-		return 0;
+		break;
 	}
     }
 
+    // Negative controls are free as long as one control is positive,
+    // otherwise the gate needs 2 more NOT gates
+    unsigned quantum_cost() const {
+	if (type_ == Gate::Id)
+	    return 0;
+	const unsigned nc = bits::popcount(ctrl_);
+	const unsigned negation = neg_ && neg_ == ctrl_ ? 2 : 0;
+	if (is_swap())
+	    return toffoli_cost(nc+1) + 2 + negation;
+	return toffoli_cost(nc) + negation;
+    }
+
     void print(std::ostream& os, unsigned bit, int line) const {
 	const Reg_t bitmask = Reg_t(1) << bit;
 	switch (type_) {
 	    case Gate::Id:
-		if (bitmask == args_[0]) {
+		if (bitmask == target_) {
 		    if (line == -1)
 			os << "\u250C\u2500\u2500\u2500\u2500\u2510";
 		    else if (line == 0)
@@ -92,7 +215,7 @@ public:
 		}
 		break;
 	    case Gate::X:
-		if (bitmask == args_[0]) {
+		if (bitmask == target_) {
 		    if (line == -1)
 			os << "\u250C\u2500\u2500\u2500\u2510";
 		    else if (line == 0)
@@ -108,7 +231,7 @@ public:
 		}
 		break;
 	    case Gate::cX:
-		if (bitmask == args_[0]) {
+		if (bitmask == target_) {
 		    if (line == -1)
 			os << "\u250C\u2500\u2500\u2500\u2510";
 		    else if (line == 0)
@@ -116,7 +239,7 @@ public:
 		    else if (line == 1)
 			os << "\u2514\u2500\u2500\u2500\u2518";
 		}
-		else if (bitmask > std::min(args_[0], args_[1]) && bitmask < std::max(args_[0], args_[1])) {
+		else if (bitmask > std::min(target_, ctrl_) && bitmask < std::max(target_, ctrl_)) {
 		    if (line == -1)
 			os << "  \u2502  ";
 		    else if (line == 0)
@@ -124,9 +247,9 @@ public:
 		    else if (line == 1)
 			os << "  \u2502  ";
 		}
-		else if (bitmask == args_[1]) {
+		else if (bitmask == ctrl_) {
 		    if (line == -1) {
-			if (args_[0] < args_[1])
+			if (target_ < ctrl_)
 			    os << "  \u2502  ";
 			else
 			    os << "     ";
@@ -135,7 +258,7 @@ public:
 			os << "\u2500\u2500o\u2500\u2500";
 		    }
 		    else if (line == 1) {
-			if (args_[0] < args_[1])
+			if (target_ < ctrl_)
 			    os << "     ";
 			else
 			    os << "  \u2502  ";
@@ -151,7 +274,7 @@ public:
 		}
 		break;
 	    case Gate::ccX:
-		if (bitmask == args_[0]) {
+		if (bitmask == target_) {
 		    if (line == -1)
 			os << "\u250C\u2500\u2500\u2500\u2510";
 		    else if (line == 0)
@@ -159,7 +282,7 @@ public:
 		    else if (line == 1)
 			os << "\u2514\u2500\u2500\u2500\u2518";
 		}
-		else if (bitmask == args_[1] || bitmask == args_[2]) {
+		else if (bitmask & ctrl_) {
 		    if (line == -1)
 			os << "     ";
 		    else if (line == 0)
@@ -177,7 +300,7 @@ public:
 		}
 		break;
 	    case Gate::Swap:
-		if (bitmask == std::min(args_[0], args_[1])) {
+		if (bitmask == Reg_t(target_ & -target_)) {
 		    if (line == -1)
 			os << "   ";
 		    else if (line == 0)
@@ -185,7 +308,7 @@ public:
 		    else if (line == 1)
 			os << " \u2502 ";
 		}
-		else if (bitmask == std::max(args_[0], args_[1])) {
+		else if (bitmask == bits::bit_floor(target_)) {
 		    if (line == -1)
 			os << " \u2502 ";
 		    else if (line == 0)
@@ -193,7 +316,7 @@ public:
 		    else if (line == 1)
 			os << "   ";
 		}
-		else if (bitmask > std::min(args_[0], args_[1]) && bitmask < std::max(args_[0], args_[1])) {
+		else if (bitmask > Reg_t(target_ & -target_) && bitmask < bits::bit_floor(target_)) {
 		    if (line == -1)
 			os << " \u2502 ";
 		    else if (line == 0)
@@ -211,7 +334,7 @@ public:
 		}
 		break;
 	    case Gate::cSwap:
-		if (bitmask == args_[0]) {
+		if (bitmask & target_) {
 		    if (line == -1)
 			os << "   ";
 		    else if (line == 0)
@@ -219,31 +342,58 @@ public:
 		    else if (line == 1)
 			os << "   ";
 		}
-		else if (bitmask == args_[1]) {
+		else if (bitmask & ctrl_) {
 		    if (line == -1)
 			os << "   ";
 		    else if (line == 0)
-			os << "\u2500\u2573\u2500";
+			os << "\u2500o\u2500";
 		    else if (line == 1)
 			os << "   ";
 		}
-		else if (bitmask == args_[2]) {
+		else {
 		    if (line == -1)
 			os << "   ";
 		    else if (line == 0)
-			os << "\u2500o\u2500";
+			os << "\u2500\u2500\u2500";
 		    else if (line == 1)
 			os << "   ";
 		}
-		else {
+		break;
+	    case Gate::mcX:
+	    case Gate::mcSwap: {
+		// Positive controls are drawn as o and negative ones as \u00AC, the
+		// lines between the first and the last line of the gate are crossed
+		const std::string pad = type_ == Gate::mcX ? " " : "";
+		const std::string wire = type_ == Gate::mcX ? "\u2500\u2500" : "\u2500";
+		const Reg_t gate_lines = target_ | ctrl_;
+		const bool above = gate_lines & (bitmask-1);
+		const bool below = gate_lines & ~(bitmask | (bitmask-1));
+		if (type_ == Gate::mcX && (bitmask & target_)) {
 		    if (line == -1)
-			os << "   ";
+			os << "\u250C\u2500\u2500\u2500\u2510";
 		    else if (line == 0)
-			os << "\u2500\u2500\u2500";
+			os << "\u2524 X \u251C";
 		    else if (line == 1)
-			os << "   ";
+			os << "\u2514\u2500\u2500\u2500\u2518";
+		}
+		else if (line == 0) {
+		    if (bitmask & target_)
+			os << wire << "\u2573" << wire;
+		    else if (bitmask & neg_)
+			os << wire << "\u00AC" << wire;
+		    else if (bitmask & ctrl_)
+			os << wire << 'o' << wire;
+		    else if (above && below)
+			os << wire << "\u253C" << wire;
+		    else
+			os << wire << "\u2500" << wire;
+		}
+		else {
+		    const bool connected = (line == -1 ? above : below) && ((bitmask & gate_lines) || (above && below));
+		    os << pad << ' ' << (connected ? "\u2502" : " ") << ' ' << pad;
 		}
 		break;
+	    }
 	    default:
 		if (line == -1)
 		    os << "\u2502";
@@ -267,54 +417,69 @@ public:
 
 private:
     Gate type_;
-    std::array<Reg_t, 3> args_;
+    Reg_t target_;
+    Reg_t ctrl_;
+    Reg_t neg_;
 
-    void apply_Id (Reg_t& reg) const { }
-    void apply_X  (Reg_t& reg) const { reg ^= args_[0]; }
-    void apply_cX (Reg_t& reg) const { if (reg & args_[1]) apply_X(reg); }
-    void apply_ccX(Reg_t& reg) const { if (reg & args_[2]) apply_cX(reg); }
-    void apply_Swap (Reg_t& reg) const { Reg_t tmp{reg}; reg &= ~(args_[0]|args_[1]); if (tmp & args_[0]) reg |= args_[1]; if (tmp & args_[1]) reg |= args_[0]; }
-    void apply_cSwap(Reg_t& reg) const { if (reg & args_[2]) apply_Swap(reg); }
+    static unsigned line(Reg_t mask) { return bits::countr_zero(mask); }
+    static unsigned last_line(Reg_t mask) { return bits::bit_width(mask) - 1; }
+
+    // Branch-free evaluation of the gate on a single register
+    bool active(Reg_t reg) const { return ((reg ^ neg_) & ctrl_) == ctrl_; }
+    void apply_toggle(Reg_t& reg) const { reg ^= target_ & -Reg_t(active(reg)); }
+    void apply_swap(Reg_t& reg) const { reg ^= target_ & -Reg_t(active(reg) && (target_ & (target_-1)) && bits::popcount(Reg_t(reg & target_)) == 1); }
 };
 
 
+// Multi-controlled gates list their number of controls followed by the
+// controls, negative controls being prefixed with ~
 template<typename Reg_t>
 std::ostream& operator<<(std::ostream& os, const Instruction<Reg_t>& inst) {
-    const auto reg2idx = [](Reg_t reg) {
-	unsigned idx = 0;
-	for (; !(reg & (Reg_t(1) << idx)) ; ++idx);
-	return idx;
+    const auto arg = [&os](Reg_t reg) {
+	os << ' '<< std::setw(2) << std::setfill(' ') << bits::countr_zero(reg);
     };
+    const Reg_t target = inst.target();
+    const Reg_t ctrl = inst.ctrl();
     switch(inst.type()) {
 	case Gate::Id:
 	    os << "Id   ";
-	    os << ' '<< std::setw(2) << std::setfill(' ') << reg2idx(inst.args()[0]);
+	    arg(target);
 	    break;
 	case Gate::X:
 	    os << "X    ";
-	    os << ' '<< std::setw(2) << std::setfill(' ') << reg2idx(inst.args()[0]);
+	    arg(target);
 	    break;
 	case Gate::cX:
 	    os << "cX   ";
-	    os << ' '<< std::setw(2) << std::setfill(' ') << reg2idx(inst.args()[0]);
-	    os << ' '<< std::setw(2) << std::setfill(' ') << reg2idx(inst.args()[1]);
+	    arg(target);
+	    arg(ctrl);
 	    break;
 	case Gate::ccX:
 	    os << "ccX  ";
-	    os << ' '<< std::setw(2) << std::setfill(' ') << reg2idx(inst.args()[0]);
-	    os << ' '<< std::setw(2) << std::setfill(' ') << reg2idx(inst.args()[1]);
-	    os << ' '<< std::setw(2) << std::setfill(' ') << reg2idx(inst.args()[2]);
+	    arg(target);
+	    arg(ctrl);
+	    arg(bits::bit_floor(ctrl));
 	    break;
 	case Gate::Swap:
 	    os << "Swap ";
-	    os << ' '<< std::setw(2) << std::setfill(' ') << reg2idx(inst.args()[0]);
-	    os << ' '<< std::setw(2) << std::setfill(' ') << reg2idx(inst.args()[1]);
+	    arg(target);
+	    arg(bits::bit_floor(target));
 	    break;
 	case Gate::cSwap:
 	    os << "cSwap";
-	    os << ' '<< std::setw(2) << std::setfill(' ') << reg2idx(inst.args()[0]);
-	    os << ' '<< std::setw(2) << std::setfill(' ') << reg2idx(inst.args()[1]);
-	    os << ' '<< std::setw(2) << std::setfill(' ') << reg2idx(inst.args()[2]);
+	    arg(target);
+	    arg(bits::bit_floor(target));
+	    arg(ctrl);
+	    break;
+	case Gate::mcX:
+	case Gate::mcSwap:
+	    os << (inst.type() == Gate::mcX ? "mcX  " : "mcSwap");
+	    arg(target);
+	    if (inst.type() == Gate::mcSwap)
+		arg(bits::bit_floor(target));
+	    os << ' ' << std::setw(2) << std::setfill(' ') << bits::popcount(ctrl);
+	    for (Reg_t c = ctrl ; c ; c &= c-1)
+		os << ' ' << std::setw(3) << std::setfill(' ') << ((inst.neg() & c & -c) ? "~" : "") + std::to_string(bits::countr_zero(c));
 	    break;
 	default:
 	    break;
@@ -326,7 +491,7 @@ std::ostream& operator<<(std::ostream& os, const Instruction<Reg_t>& inst) {
 template<typename Reg_t>
 std::istream& operator>>(std::istream& is, Instruction<Reg_t>& inst) {
     std::string name;
-    unsigned arg0, arg1, arg2;
+    unsigned arg0 = 0, arg1 = 0, arg2 = 0;
     is >> name;
     if (name == "Id") {
 	is >> arg0;
@@ -358,6 +523,28 @@ std::istream& operator>>(std::istream& is, Instruction<Reg_t>& inst) {
 	is >> arg2;
 	inst = Instruction<Reg_t>(Gate::cSwap, arg0, arg1, arg2);
     }
+    else if (name == "mcX" || name == "mcSwap") {
+	is >> arg0;
+	Reg_t target = Reg_t(1) << arg0;
+	if (name == "mcSwap") {
+	    is >> arg1;
+	    target |= Reg_t(1) << arg1;
+	}
+	unsigned n = 0;
+	is >> n;
+	Reg_t ctrl = 0;
+	Reg_t neg = 0;
+	for (unsigned i = 0 ; i < n ; ++i) {
+	    std::string c;
+	    is >> c;
+	    const bool negative = !c.empty() && c[0] == '~';
+	    const Reg_t bit = Reg_t(1) << std::stoul(c.substr(negative));
+	    ctrl |= bit;
+	    if (negative)
+		neg |= bit;
+	}
+	inst = Instruction<Reg_t>(target, ctrl, neg);
+    }
     else {
 	assert(false && "Unknown Gate!");
     }
@@ -0,0 +1,144 @@
+#ifndef ISLAND_HH_
+#define ISLAND_HH_
+
+#include <string>
+#include <sstream>
+#include <vector>
+#include <iostream>
+#include <cstdlib>
+#include <algorithm>
+#include <mpi.h>
+#include "circuit.hh"
+
+
+// Island model over MPI: every rank runs its own population and the ranks
+// periodically send copies of their best circuits to their neighbours, which
+// replace their worst families with them.
+enum class Topology { Ring, Complete };
+
+
+struct MigrationOptions {
+    // Number of generations between two migrations, 0 disables the migrations
+    unsigned interval = 0;
+    // Number of circuits sent by every rank at each migration
+    unsigned size = 1;
+    Topology topology = Topology::Ring;
+};
+
+
+inline Topology parse_topology(const std::string& name) {
+    if (name == "ring")
+	return Topology::Ring;
+    if (name == "complete")
+	return Topology::Complete;
+    std::cout << "Unknown topology: '" << name << "'" << std::endl;
+    exit(1);
+}
+
+
+// Strings of all the ranks, in rank order
+inline std::vector<std::string> allgather_strings(const std::string& data, MPI_Comm comm) {
+    int size;
+    MPI_Comm_size(comm, &size);
+    int length = data.size();
+    std::vector<int> lengths(size);
+    MPI_Allgather(&length, 1, MPI_INT, lengths.data(), 1, MPI_INT, comm);
+    std::vector<int> displs(size, 0);
+    for (int r = 1 ; r < size ; ++r)
+	displs[r] = displs[r-1] + lengths[r-1];
+    std::string all(displs.back() + lengths.back(), '\0');
+    MPI_Allgatherv(data.data(), length, MPI_CHAR, all.data(), lengths.data(), displs.data(), MPI_CHAR, comm);
+    std::vector<std::string> strings(size);
+    for (int r = 0 ; r < size ; ++r)
+	strings[r] = all.substr(displs[r], lengths[r]);
+    return strings;
+}
+
+
+// Send a string to the next rank and receive the one of the previous rank
+inline std::string ring_shift(const std::string& data, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    const int next = (rank + 1) % size;
+    const int prev = (rank + size - 1) % size;
+    int length = data.size();
+    int prev_length;
+    MPI_Sendrecv(&length, 1, MPI_INT, next, 0, &prev_length, 1, MPI_INT, prev, 0, comm, MPI_STATUS_IGNORE);
+    std::string received(prev_length, '\0');
+    MPI_Sendrecv(data.data(), length, MPI_CHAR, next, 1, received.data(), prev_length, MPI_CHAR, prev, 1, comm, MPI_STATUS_IGNORE);
+    return received;
+}
+
+
+template<typename Reg_t>
+std::string serialize_circuits(const std::vector<Circuit<Reg_t>>& circuits) {
+    std::ostringstream os;
+    os << circuits.size() << '\n';
+    for (const auto& circuit : circuits)
+	circuit.serialize(os);
+    return os.str();
+}
+
+
+template<typename Reg_t>
+void deserialize_circuits(const std::string& data, std::vector<Circuit<Reg_t>>& circuits) {
+    std::istringstream is(data);
+    size_t n;
+    is >> n;
+    for (size_t i = 0 ; i < n ; ++i)
+	circuits.push_back(Circuit<Reg_t>::deserialize(is));
+}
+
+
+// Exchange the elites of the optimizers of all the ranks along the topology
+template<typename Reg_t, typename Optimizer_t, typename Rng_t>
+void migrate(Optimizer_t& optimizer, Rng_t& rng, const MigrationOptions& options, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    if (size == 1)
+	return;
+    const std::string emigrants = serialize_circuits(optimizer.elites(options.size));
+    std::vector<Circuit<Reg_t>> immigrants;
+    if (options.topology == Topology::Ring) {
+	deserialize_circuits(ring_shift(emigrants, comm), immigrants);
+    }
+    else {
+	const auto all = allgather_strings(emigrants, comm);
+	for (int r = 0 ; r < size ; ++r) {
+	    if (r != rank)
+		deserialize_circuits(all[r], immigrants);
+	}
+    }
+    optimizer.immigrate(rng, immigrants);
+}
+
+
+// Run the optimizer for the given number of generations, migrating before
+// every generation whose number is a multiple of options.interval. All the
+// ranks must run the same number of generations. With migrations, all the
+// ranks stop after the migration interval in which one of them met a
+// stopping criterion. Returns whether the optimization stopped early.
+template<typename Reg_t, typename Optimizer_t, typename Rng_t>
+bool optimize_island(Optimizer_t& optimizer, Rng_t& rng, unsigned generations, double ds, unsigned b, const MigrationOptions& options, MPI_Comm comm) {
+    if (options.interval == 0) {
+	optimizer.optimize(rng, generations, ds, b);
+	return optimizer.stopped();
+    }
+    const unsigned last = optimizer.generation() + generations;
+    while (optimizer.generation() < last) {
+	const unsigned g = optimizer.generation();
+	if (g > 0 && g % options.interval == 0)
+	    migrate<Reg_t>(optimizer, rng, options, comm);
+	optimizer.optimize(rng, std::min(last, (g/options.interval + 1)*options.interval) - g, ds, b);
+	int stopped = optimizer.stopped();
+	MPI_Allreduce(MPI_IN_PLACE, &stopped, 1, MPI_INT, MPI_LOR, comm);
+	if (stopped)
+	    return true;
+    }
+    return false;
+}
+
+
+#endif // ISLAND_HH_
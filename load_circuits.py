@@ -88,6 +88,24 @@ def ascii2qiskit(source, output_size=1):
     circuit = qiskit.circuit.QuantumCircuit(num_lines, output_size)
     for instruction in lines[1:]:
         gate = instruction.split()[0]
+        if gate in ('mcX', 'mcSwap'):
+            # Targets, number of controls and controls, negative ones prefixed with ~
+            tokens = instruction.split()[1:]
+            num_targets = 1 if gate == 'mcX' else 2
+            targets = list(map(int, tokens[:num_targets]))
+            ctrl_bits = [int(c.lstrip('~')) for c in tokens[num_targets+1:]]
+            neg_bits = [int(c[1:]) for c in tokens[num_targets+1:] if c[0] == '~']
+            for bit in neg_bits:
+                circuit.x(bit)
+            if gate == 'mcX':
+                circuit.mcx(ctrl_bits, targets[0])
+            else:
+                circuit.cx(targets[0], targets[1])
+                circuit.mcx(ctrl_bits+[targets[1]], targets[0])
+                circuit.cx(targets[0], targets[1])
+            for bit in neg_bits:
+                circuit.x(bit)
+            continue
         args = list(map(int, instruction.split()[1:]))
         if gate == 'Id':
             circuit.i(args[0])
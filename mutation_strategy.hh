@@ -2,14 +2,74 @@
 #define MUTATION_STRATEGY_HH_
 
 #include <algorithm>
+#include <array>
+#include <climits>
 #include <cstdint>
+#include <iostream>
 #include <random>
+#include <sstream>
+#include <string>
+#include <tuple>
 #include <vector>
 #include <map>
+#include <numeric>
+#include "alias_table.hh"
 #include "circuit.hh"
 #include "instruction.hh"
 
 
+// Operators applied to a circuit by a mutation
+enum class MutationOperator { Replace, Insert, Remove, Swap, Retarget, Invert };
+
+
+// Relative probabilities of the mutation operators, as given on the command
+// line by name=weight pairs separated by commas, e.g. replace=4,insert=1.
+// The operators missing from the list get a weight of 0.
+//   replace   replace a gate by a random one
+//   insert    insert a random gate, shifting the following gates and
+//             dropping the last one
+//   remove    remove a gate, shifting the following gates and appending an
+//             Id gate
+//   swap      exchange two adjacent gates
+//   retarget  move the controls of a gate to other lines, keeping its
+//             targets and the polarities of its controls
+//   invert    invert a block of gates, i.e. reverse it since every gate is
+//             its own inverse
+struct MutationWeights {
+    static constexpr std::array<const char*, 6> names = {"replace", "insert", "remove", "swap", "retarget", "invert"};
+
+    std::array<double, 6> weight{1, 0, 0, 0, 0, 0};
+
+    double operator[](MutationOperator op) const { return weight[static_cast<unsigned>(op)]; }
+};
+
+
+inline MutationWeights parse_mutation_weights(const std::string& str) {
+    MutationWeights weights;
+    weights.weight.fill(0);
+    std::istringstream is(str);
+    double sum = 0;
+    for (std::string entry ; std::getline(is, entry, ',') ;) {
+	const size_t eq = entry.find('=');
+	const auto it = std::find(MutationWeights::names.begin(), MutationWeights::names.end(), entry.substr(0, eq));
+	std::istringstream ws(eq == std::string::npos ? "" : entry.substr(eq+1));
+	double w = -1;
+	ws >> w;
+	if (it == MutationWeights::names.end() || !ws || w < 0) {
+	    std::cout << "Invalid mutation weight: '" << entry << "'" << std::endl;
+	    exit(1);
+	}
+	weights.weight[it - MutationWeights::names.begin()] = w;
+	sum += w;
+    }
+    if (sum <= 0) {
+	std::cout << "The mutation weights must not all be 0" << std::endl;
+	exit(1);
+    }
+    return weights;
+}
+
+
 template<typename Reg_t>
 class BaseMutationStrategy {
 public:
@@ -19,34 +79,159 @@ public:
     BaseMutationStrategy& operator=(const BaseMutationStrategy&) = default;
     BaseMutationStrategy& operator=(BaseMutationStrategy&&) = default;
 
-    template<typename Rng_t>
-    void mutate(Rng_t& rng, Circuit<Reg_t>& circuit) const {
-	std::uniform_int_distribution<unsigned> dist(0, circuit.d()-1);
-	const unsigned idx = dist(rng);
-	circuit[idx] = random_gate(rng);
+    // Returns the index of the first modified gate
+    template<typename Rng_t, typename Circuit_t>
+    unsigned mutate(Rng_t& rng, Circuit_t&& circuit) const {
+	const MutationOperator op = operators_.size() == 1 ? operators_[0] : operators_[operator_table_(rng)];
+	return mutate(rng, circuit, op);
     }
 
-    template<typename Rng_t>
-    void randomize(Rng_t& rng, Circuit<Reg_t>& circuit) const {
+    // Mutation with a given operator. The operators needing more gates than
+    // the circuit has fall back to a replacement, and so does a retargeting
+    // of a gate without controls.
+    template<typename Rng_t, typename Circuit_t>
+    unsigned mutate(Rng_t& rng, Circuit_t&& circuit, MutationOperator op) const {
+	const unsigned d = circuit.d();
+	if ((op == MutationOperator::Swap || op == MutationOperator::Invert) && d >= 2) {
+	    // The block of an inversion spans the gates idx to last
+	    unsigned idx = std::uniform_int_distribution<unsigned>(0, d-2)(rng);
+	    unsigned last = idx+1;
+	    if (op == MutationOperator::Invert) {
+		last = std::uniform_int_distribution<unsigned>(0, d-2)(rng);
+		if (last >= idx)
+		    ++last;
+		std::tie(idx, last) = std::minmax(idx, last);
+	    }
+	    for (unsigned i = idx, j = last ; i < j ; ++i, --j) {
+		const Instruction<Reg_t> g = circuit[i];
+		circuit.set(i, circuit[j]);
+		circuit.set(j, g);
+	    }
+	    return idx;
+	}
+	const unsigned idx = std::uniform_int_distribution<unsigned>(0, d-1)(rng);
+	if (op == MutationOperator::Insert) {
+	    for (unsigned i = d-1 ; i > idx ; --i)
+		circuit.set(i, circuit[i-1]);
+	}
+	else if (op == MutationOperator::Remove) {
+	    for (unsigned i = idx ; i+1 < d ; ++i)
+		circuit.set(i, circuit[i+1]);
+	    circuit.set(d-1, Instruction<Reg_t>(Gate::Id, 0));
+	    return idx;
+	}
+	else if (op == MutationOperator::Retarget && circuit[idx].ctrl()) {
+	    circuit.set(idx, retargeted(rng, circuit[idx]));
+	    return idx;
+	}
+	circuit.set(idx, random_gate(rng));
+	return idx;
+    }
+
+    const MutationWeights& weights() const { return weights_; }
+
+    template<typename Rng_t, typename Circuit_t>
+    void randomize(Rng_t& rng, Circuit_t&& circuit) const {
 	for (unsigned i = 0 ; i < circuit.d() ; ++i) {
-	    circuit[i] = random_gate(rng);
+	    circuit.set(i, random_gate(rng));
 	}
     }
 
 protected:
+    // The 3-line and multi-controlled gates are too many to be enumerated,
+    // they are drawn on the fly from classes given by their number of controls
+    struct MultiControlled {
+	unsigned controls;
+	bool swap;
+	// Whether the polarity of every control is drawn
+	bool negative;
+	// Whether at least one control is negative, the gates with only positive
+	// controls being drawn as fixed gates
+	bool some_negative = false;
+    };
+
     std::vector<Instruction<Reg_t>> instruction_set_;
-    std::vector<double> cdf_;
+    std::vector<MultiControlled> multi_controlled_;
+    // Draws the gates among the instruction set followed by the
+    // multi-controlled classes
+    AliasTable gate_table_;
+    unsigned l_ = 0;
+
+    void set_weights(const MutationWeights& weights) {
+	weights_ = weights;
+	operators_.clear();
+	std::vector<double> w;
+	for (unsigned k = 0 ; k < weights.weight.size() ; ++k) {
+	    if (weights.weight[k] > 0) {
+		operators_.push_back(MutationOperator(k));
+		w.push_back(weights.weight[k]);
+	    }
+	}
+	operator_table_ = AliasTable(w);
+    }
 
 private:
+    MutationWeights weights_;
+    // Operators with a positive weight and the table drawing them
+    std::vector<MutationOperator> operators_{MutationOperator::Replace};
+    AliasTable operator_table_;
+
     template<typename Rng_t>
-    const Instruction<Reg_t>& random_gate(Rng_t& rng) const {
-	std::uniform_real_distribution<double> dist(0, 1);
-	const double p = dist(rng);
-	for (unsigned i = 0 ; i < cdf_.size() ; ++i) {
-	    if (p <= cdf_[i])
-		return instruction_set_[i];
+    Instruction<Reg_t> random_gate(Rng_t& rng) const {
+	const size_t i = gate_table_(rng);
+	return i < instruction_set_.size() ? instruction_set_[i] : random_multi_controlled(rng, multi_controlled_[i - instruction_set_.size()]);
+    }
+
+    // Same gate with its controls moved to random lines other than its
+    // targets, the k-th new control having the polarity of the k-th old one
+    template<typename Rng_t>
+    Instruction<Reg_t> retargeted(Rng_t& rng, const Instruction<Reg_t>& g) const {
+	unsigned lines[CHAR_BIT*sizeof(Reg_t)];
+	unsigned n = 0;
+	for (unsigned k = 0 ; k < l_ ; ++k) {
+	    if (!((g.target() >> k) & 1))
+		lines[n++] = k;
+	}
+	Reg_t ctrl = 0;
+	Reg_t neg = 0;
+	unsigned k = 0;
+	for (Reg_t c = g.ctrl() ; c ; c &= c-1, ++k) {
+	    std::swap(lines[k], lines[std::uniform_int_distribution<unsigned>(k, n-1)(rng)]);
+	    ctrl |= Reg_t(1) << lines[k];
+	    if (g.neg() & c & -c)
+		neg |= Reg_t(1) << lines[k];
 	}
-	return instruction_set_.back();
+	return Instruction<Reg_t>(g.target(), ctrl, neg);
+    }
+
+    template<typename Rng_t>
+    Instruction<Reg_t> random_multi_controlled(Rng_t& rng, const MultiControlled& mc) const {
+	// Partial Fisher-Yates shuffle of the lines, the first ones are the targets
+	unsigned lines[CHAR_BIT*sizeof(Reg_t)];
+	std::iota(lines, lines+l_, 0);
+	const unsigned num_targets = mc.swap ? 2 : 1;
+	for (unsigned k = 0 ; k < num_targets + mc.controls ; ++k)
+	    std::swap(lines[k], lines[std::uniform_int_distribution<unsigned>(k, l_-1)(rng)]);
+	Reg_t target = 0;
+	Reg_t ctrl = 0;
+	Reg_t neg = 0;
+	for (unsigned k = 0 ; k < num_targets ; ++k)
+	    target |= Reg_t(1) << lines[k];
+	for (unsigned k = num_targets ; k < num_targets + mc.controls ; ++k)
+	    ctrl |= Reg_t(1) << lines[k];
+	if (mc.negative) {
+	    // Rejection of the all-positive polarities takes at most 2 draws on
+	    // average
+	    std::uniform_int_distribution<unsigned> polarity(0, 1);
+	    do {
+		neg = 0;
+		for (unsigned k = num_targets ; k < num_targets + mc.controls ; ++k) {
+		    if (polarity(rng))
+			neg |= Reg_t(1) << lines[k];
+		}
+	    } while (mc.some_negative && !neg);
+	}
+	return Instruction<Reg_t>(target, ctrl, neg);
     }
 };
 
@@ -54,12 +239,19 @@ private:
 template<typename Reg_t>
 class FullyConnectedMutationStrategy : public BaseMutationStrategy<Reg_t> {
 public:
-    FullyConnectedMutationStrategy(unsigned l) {
+    // The gates act on at most max_gate_size lines. Toffoli and Fredkin gates
+    // acting on 4 to max_gate_size lines, i.e. the t4, f4, t5, ... gates of
+    // RevLib, are added to the fixed gates, each size being as likely as a
+    // fixed gate type. With negative_controls, every control of these gates is
+    // negative with probability 1/2 and they start at 1 control so that the
+    // smaller gates also get negative controls. The smaller ones then have at
+    // least one negative control, their positive versions being the cX, ccX
+    // and cSwap gates.
+    FullyConnectedMutationStrategy(unsigned l, unsigned max_gate_size=3, bool negative_controls=false, const MutationWeights& weights=MutationWeights()) {
 	std::vector<unsigned> bits(l);
 	std::iota(bits.begin(), bits.end(), 0);
 	const auto connections1 = permutations(bits, 1);
 	const auto connections2 = permutations(bits, 1, connections1);
-	const auto connections3 = permutations(bits, 1, connections2);
 	std::map<Gate, unsigned> instructions_per_gate;
 	// Add the 1-bit gates
 	if (l >= 1) {
@@ -72,8 +264,9 @@ public:
 		BaseMutationStrategy<Reg_t>::instruction_set_.emplace_back(Gate::X, conn[0], 0, 0);
 	    instructions_per_gate[Gate::X] = connections1.size();
 	}
+	const unsigned max_lines = std::min(max_gate_size, l);
 	// Add the 2-bit gates
-	if (l >= 2) {
+	if (max_lines >= 2) {
 	    // cX
 	    for (auto&& conn : connections2)
 		BaseMutationStrategy<Reg_t>::instruction_set_.emplace_back(Gate::cX, conn[0], conn[1], 0);
@@ -83,29 +276,24 @@ public:
 		BaseMutationStrategy<Reg_t>::instruction_set_.emplace_back(Gate::Swap, conn[0], conn[1], 0);
 	    instructions_per_gate[Gate::Swap] = connections2.size();
 	}
-	// Add the 3-bit gates
-	if (l >= 3) {
-	    // ccX
-	    for (auto&& conn : connections3)
-		BaseMutationStrategy<Reg_t>::instruction_set_.emplace_back(Gate::ccX, conn[0], conn[1], conn[2]);
-	    instructions_per_gate[Gate::ccX] = connections3.size();
-	    // cSwap
-	    for (auto&& conn : connections3)
-		BaseMutationStrategy<Reg_t>::instruction_set_.emplace_back(Gate::cSwap, conn[0], conn[1], conn[2]);
-	    instructions_per_gate[Gate::cSwap] = connections3.size();
-	}
-	// Compute the CDF for the instruction probabilities
-	const unsigned num_inst = BaseMutationStrategy<Reg_t>::instruction_set_.size();
-	BaseMutationStrategy<Reg_t>::cdf_.resize(num_inst);
-	Gate g = BaseMutationStrategy<Reg_t>::instruction_set_[0].type();
-	BaseMutationStrategy<Reg_t>::cdf_[0] = 1.0 / instructions_per_gate[g];
-	for (unsigned i = 1 ; i < BaseMutationStrategy<Reg_t>::instruction_set_.size() ; ++i) {
-	    g = BaseMutationStrategy<Reg_t>::instruction_set_[i].type();
-	    BaseMutationStrategy<Reg_t>::cdf_[i] = BaseMutationStrategy<Reg_t>::cdf_[i-1] + 1.0/instructions_per_gate[g];
+	// Add the 3-bit gates ccX and cSwap, l(l-1)(l-2) of each, as classes
+	if (max_lines >= 3) {
+	    BaseMutationStrategy<Reg_t>::multi_controlled_.push_back({2, false, false});
+	    BaseMutationStrategy<Reg_t>::multi_controlled_.push_back({1, true, false});
 	}
-	const auto cdf_max = BaseMutationStrategy<Reg_t>::cdf_.back();
-	for (auto& p : BaseMutationStrategy<Reg_t>::cdf_)
-	    p /= cdf_max;
+	// Add the multi-controlled gates
+	BaseMutationStrategy<Reg_t>::l_ = l;
+	for (unsigned k = negative_controls ? 1 : 3 ; k+1 <= max_lines ; ++k)
+	    BaseMutationStrategy<Reg_t>::multi_controlled_.push_back({k, false, negative_controls, k < 3});
+	for (unsigned k = negative_controls ? 1 : 2 ; k+2 <= max_lines ; ++k)
+	    BaseMutationStrategy<Reg_t>::multi_controlled_.push_back({k, true, negative_controls, k < 2});
+	// Every fixed gate type is as likely as a 3-bit or multi-controlled class
+	std::vector<double> gate_weights;
+	for (const auto& inst : BaseMutationStrategy<Reg_t>::instruction_set_)
+	    gate_weights.push_back(1.0 / instructions_per_gate[inst.type()]);
+	gate_weights.resize(gate_weights.size() + BaseMutationStrategy<Reg_t>::multi_controlled_.size(), 1.0);
+	BaseMutationStrategy<Reg_t>::gate_table_ = AliasTable(gate_weights);
+	BaseMutationStrategy<Reg_t>::set_weights(weights);
     }
 
     FullyConnectedMutationStrategy() = default;
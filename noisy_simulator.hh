@@ -0,0 +1,216 @@
+#ifndef NOISY_SIMULATOR_HH_
+#define NOISY_SIMULATOR_HH_
+
+#include <cstdint>
+#include <cstddef>
+#include <climits>
+#include <cmath>
+#include <array>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <tuple>
+#include <algorithm>
+#include <bit>
+#include "bits.hh"
+#include "instruction.hh"
+#include "circuit.hh"
+#include "truth_table.hh"
+#include "bit_sliced_registers.hh"
+
+
+// Classical noise model of a reversible circuit: after every gate each of its
+// lines is flipped independently, and every output line is flipped on readout
+// with a probability depending on its value. Since the circuits only move
+// basis states around, bit flips are the only errors that change a measured
+// output. The routing of the gates on the coupling map is not modelled.
+//
+// The gate errors are those of the calibration, i.e. average infidelities r
+// of a depolarizing channel on the n lines of the gate. It replaces their
+// state by a random one with probability lambda = r*2^n/(2^n-1), which flips
+// every one of the lines with probability lambda/2.
+//
+// The parameter file has one entry per line, # starts a comment:
+//   cost <r>              error of a gate of unit quantum cost, a CNOT. A
+//                         gate of cost c on n lines is c CNOTs, each of which
+//                         acts on 2 of the n lines.
+//   gate <type> <r>       error of the gates of a type (Id, X, cX, ccX, Swap,
+//                         cSwap, mcX, mcSwap) instead
+//   readout <p01> <p10>   probabilities to read 1 for 0 and 0 for 1, one entry
+//                         per line in line order, the last one is used for
+//                         the lines without their own entry
+struct NoiseModel {
+    double cost = 0;
+    // Negative if the cost applies
+    std::array<double, 8> gate{-1, -1, -1, -1, -1, -1, -1, -1};
+    std::vector<std::pair<double, double>> readout;
+    // Factor applied to all the errors, e.g. to sweep the noise strength
+    double scale = 1;
+
+    // Probability that the gate flips each one of its lines
+    template<typename Reg_t>
+    double flip_probability(const Instruction<Reg_t>& inst) const {
+	const unsigned n = std::max(1, bits::popcount(Reg_t(inst.target() | inst.ctrl())));
+	const double r = gate[static_cast<unsigned>(inst.type())];
+	if (r >= 0)
+	    return depolarizing(scaled(r), n) / 2;
+	// Expected number of the CNOTs acting on one of the lines
+	const double cnots = n <= 2 ? inst.quantum_cost() : 2.0*inst.quantum_cost() / n;
+	return (1 - std::pow(1 - depolarizing(scaled(cost), 2), cnots)) / 2;
+    }
+
+    std::pair<double, double> readout_error(unsigned line) const {
+	if (readout.empty())
+	    return {0, 0};
+	const auto& [p01, p10] = readout[std::min<size_t>(line, readout.size()-1)];
+	return {scaled(p01), scaled(p10)};
+    }
+
+private:
+    double scaled(double p) const { return std::clamp(p*scale, 0.0, 1.0); }
+
+    // Depolarizing parameter of a channel on n lines with average infidelity r
+    static double depolarizing(double r, unsigned n) {
+	const double dim = std::ldexp(1.0, std::min(n, 64u));
+	return std::min(1.0, r * dim / (dim - 1));
+    }
+};
+
+
+inline NoiseModel load_noise_model(const std::string& path) {
+    static const char* gate_names[] = {"Id", "X", "cX", "ccX", "Swap", "cSwap", "mcX", "mcSwap"};
+    std::ifstream is(path);
+    if (!is) {
+	std::cout << "Could not open noise model '" << path << "'" << std::endl;
+	exit(1);
+    }
+    NoiseModel noise;
+    for (std::string line ; std::getline(is, line) ;) {
+	std::istringstream ls(line.substr(0, line.find('#')));
+	std::string keyword;
+	if (!(ls >> keyword))
+	    continue;
+	bool ok = false;
+	if (keyword == "cost") {
+	    ok = static_cast<bool>(ls >> noise.cost);
+	}
+	else if (keyword == "gate") {
+	    std::string name;
+	    double p;
+	    ls >> name >> p;
+	    const auto it = std::find(std::begin(gate_names), std::end(gate_names), name);
+	    ok = ls && it != std::end(gate_names);
+	    if (ok)
+		noise.gate[it - std::begin(gate_names)] = p;
+	}
+	else if (keyword == "readout") {
+	    double p01, p10;
+	    ok = static_cast<bool>(ls >> p01 >> p10);
+	    noise.readout.emplace_back(p01, p10);
+	}
+	if (!ok) {
+	    std::cout << "Invalid noise model entry: '" << line << "'" << std::endl;
+	    exit(1);
+	}
+    }
+    return noise;
+}
+
+
+// Flip every one of the first n bits with probability p, drawing the gaps
+// between the flipped bits so that the cost is proportional to the flips
+template<typename Word_t, typename Rng_t>
+void flip_random(Word_t* bits, size_t n, double p, Rng_t& rng) {
+    constexpr unsigned word_bits = CHAR_BIT*sizeof(Word_t);
+    if (p <= 0)
+	return;
+    if (p >= 1) {
+	for (size_t k = 0 ; k < n ; ++k)
+	    bits[k / word_bits] ^= Word_t(1) << (k % word_bits);
+	return;
+    }
+    std::geometric_distribution<size_t> gap(p);
+    for (size_t k = gap(rng) ; k < n ; k += gap(rng) + 1)
+	bits[k / word_bits] ^= Word_t(1) << (k % word_bits);
+}
+
+
+// Error rates of a circuit under a noise model estimated with the given
+// number of shots per input, with the same definitions as Circuit::errors.
+// The shots are split into chunks of bit-sliced registers simulated in
+// parallel, every chunk seeding its own RNG so that the result does not
+// depend on the number of threads.
+template<typename Reg_t>
+std::tuple<double, double, double> noisy_errors(const Circuit<Reg_t>& circuit, const TruthTable& func, const NoiseModel& noise, unsigned shots, uint64_t seed) {
+    using Word_t = uint64_t;
+    const unsigned l = circuit.l();
+    const unsigned output_size = func.output_size();
+    const size_t input_count = func.input_count();
+    // Every chunk holds chunk_shots shots of all the inputs
+    const size_t chunk_shots = std::max<size_t>(1, 4096 / input_count);
+    const size_t num_chunks = (shots + chunk_shots - 1) / chunk_shots;
+    std::vector<Reg_t> inputs(chunk_shots*input_count);
+    std::vector<Reg_t> exact(chunk_shots*input_count);
+    size_t num_positive = 0;
+    for (size_t k = 0 ; k < inputs.size() ; ++k) {
+	inputs[k] = Reg_t(k % input_count);
+	exact[k] = func.func_eval(inputs[k]);
+	if (k < input_count)
+	    num_positive += bits::popcount(exact[k]);
+    }
+    const BitSlicedRegisters<Word_t> expected(output_size, exact);
+    const std::vector<double> flip = [&] {
+	std::vector<double> p(circuit.d());
+	for (unsigned i = 0 ; i < circuit.d() ; ++i)
+	    p[i] = noise.flip_probability(circuit[i]);
+	return p;
+    }();
+
+    double e = 0;
+    double fn = 0;
+    double fp = 0;
+    #pragma omp parallel for schedule(dynamic, 1) reduction(+:e, fn, fp)
+    for (size_t chunk = 0 ; chunk < num_chunks ; ++chunk) {
+	std::seed_seq seq{uint32_t(seed), uint32_t(seed >> 32), uint32_t(chunk), uint32_t(chunk >> 32)};
+	std::mt19937_64 rng(seq);
+	const size_t n = std::min<size_t>(chunk_shots, shots - chunk*chunk_shots) * input_count;
+	BitSlicedRegisters<Word_t> regs(l, n);
+	regs.load(std::vector<Reg_t>(inputs.begin(), inputs.begin()+n));
+	for (unsigned i = 0 ; i < circuit.d() ; ++i) {
+	    const auto& inst = circuit[i];
+	    inst.apply(regs);
+	    if (flip[i] > 0) {
+		for (Reg_t lines = inst.target() | inst.ctrl() ; lines ; lines &= lines-1)
+		    flip_random(regs.plane(bits::countr_zero(lines)), n, flip[i], rng);
+	    }
+	}
+	std::vector<Word_t> flip0(regs.words());
+	std::vector<Word_t> flip1(regs.words());
+	for (unsigned bit = 0 ; bit < output_size ; ++bit) {
+	    const unsigned line = l - output_size + bit;
+	    const auto [p01, p10] = noise.readout_error(line);
+	    std::fill(flip0.begin(), flip0.end(), Word_t(0));
+	    std::fill(flip1.begin(), flip1.end(), Word_t(0));
+	    flip_random(flip0.data(), n, p01, rng);
+	    flip_random(flip1.data(), n, p10, rng);
+	    const Word_t* out = regs.plane(line);
+	    const Word_t* ex = expected.plane(bit);
+	    for (size_t w = 0 ; w < regs.words() ; ++w) {
+		const Word_t read = out[w] ^ ((~out[w] & flip0[w]) | (out[w] & flip1[w]));
+		const Word_t wrong = (read ^ ex[w]) & regs.valid_mask(w);
+		e += std::popcount(wrong);
+		fp += std::popcount(wrong & ~ex[w]);
+		fn += std::popcount(wrong & ex[w]);
+	    }
+	}
+    }
+    const double total = double(shots) * output_size * input_count;
+    const double positive = double(shots) * num_positive;
+    return {e / total, fn / positive, fp / (total - positive)};
+}
+
+
+#endif // NOISY_SIMULATOR_HH_
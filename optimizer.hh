@@ -2,41 +2,303 @@
 #define OPTIMIZER_HH_
 
 #include <cstdint>
+#include <cassert>
+#include <limits>
 #include <vector>
 #include <iostream>
 #include <iomanip>
 #include <array>
 #include <algorithm>
 #include <random>
+#include <numeric>
+#include <bit>
+#include <utility>
+#include <omp.h>
 #include "circuit.hh"
+#include "truth_table.hh"
+#include "bit_sliced_registers.hh"
+#include "compiled_circuit.hh"
+#include "fitness_cache.hh"
+#include "population.hh"
+#include "checkpoint.hh"
+#include "adaptive_control.hh"
+#include "telemetry.hh"
+#include "hard_examples.hh"
 
 
-template<typename Reg_t, typename Func_t, typename MutStrat_t>
-class Optimizer : public Func_t {
-public:
-    using Func_t::func_eval;
+// Optional evaluation modes of the optimizer
+struct OptimizerOptions {
+    // Cache the register states of every parent every incremental_interval
+    // gates and simulate its offspring from the last state before their
+    // mutation. All species share one batch of inputs per generation. 0
+    // disables the incremental evaluation.
+    unsigned incremental_interval = 0;
+    // Evaluate every circuit on the full truth table instead of sampled
+    // inputs. The fitness is exact and no fails are collected.
+    bool exhaustive = false;
+    // Number of fitness values memoized by circuit hash, 0 disables the cache.
+    // With sampled inputs only circuits evaluated on the same batch match.
+    size_t cache_size = 0;
+    // Number of threads evaluating the species of a generation. When nonzero
+    // every species draws from its own RNG stream seeded from the main one,
+    // so the results do not depend on the number of threads. 0 evaluates the
+    // species sequentially from the main RNG.
+    unsigned species_threads = 0;
+    // Replace the survivors by their simplified circuit padded with Id gates
+    // every rewrite_interval generations, which leaves their fitness
+    // unchanged and frees gates for the mutations. 0 disables the rewrites.
+    unsigned rewrite_interval = 0;
+    // Adapt the mutation operator probabilities, the fraction of random
+    // inputs and the batch size during the optimization, see AdaptiveControl.
+    // The ds and b given to optimize are the starting values.
+    bool adaptive = false;
+    // Stop once a survivor has no wrong output on the full truth table, which
+    // is checked for the survivors without wrong output on their batch
+    bool stop_on_exact = false;
+    // Stop once the fittest survivor has not been exactly fitter, i.e. on the
+    // full truth table, than the best one so far for plateau generations. 0
+    // disables the criterion.
+    unsigned plateau = 0;
+    // Stop once this many circuits have been evaluated, cache hits included,
+    // or this many seconds after the construction of the optimizer. 0
+    // disables the budget.
+    uint64_t max_evaluations = 0;
+    double max_seconds = 0;
+    // Re-randomize the families whose survivor is less fit than the median
+    // one every stagnation_limit generations without improvement of the exact
+    // fitness of the fittest survivor, as for plateau. 0 disables the
+    // restarts.
+    unsigned stagnation_limit = 0;
+};
+
+
+// Criterion that stopped an optimization
+enum class StopReason { None, Exact, Plateau, Evaluations, Time };
 
+
+// The function is read from its truth table, which has to outlive the optimizer
+template<typename Reg_t, typename MutStrat_t>
+class Optimizer {
+public:
     template<typename Rng_t>
-    Optimizer(Rng_t& rng, unsigned l, unsigned d, unsigned S, unsigned F, MutStrat_t& mut_strat) : l_(l), d_(d), S_(S), F_(F), fails_(), population_(S_*F_, Circuit<Reg_t>(l, d)), mut_strat_(mut_strat) {
-	for (auto& c : population_)
-	    mut_strat_.randomize(rng, c);
+    Optimizer(Rng_t& rng, const TruthTable& func, unsigned l, unsigned d, unsigned S, unsigned F, MutStrat_t& mut_strat, const OptimizerOptions& options = {})
+	: func_(func), l_(l), d_(d), S_(S), F_(F), options_(options), hard_(options.exhaustive ? 0 : func.input_count()), population_(S_*F_, l, d), next_population_(S_*F_, l, d), order_(S_*F_), mutated_at_(S_*F_, 0), operators_(S_*F_, MutationOperator::Replace), mut_strat_(mut_strat), control_(mut_strat.weights()),
+	  batches_(num_workers()), scratch_(num_workers()), verified_(options.stop_on_exact || options.plateau > 0 || options.stagnation_limit > 0 ? S : 0), start_(std::chrono::steady_clock::now()) {
+	for (unsigned k = 0 ; k < S_*F_ ; ++k)
+	    mut_strat_.randomize(rng, population_[k]);
+	survivors_.resize(S_);
+	survivor_fitness_.assign(S_, 0);
+	fitness_.resize(F_);
+	individual_fitness_.resize(S_*F_);
+	if (options_.adaptive)
+	    parent_fitness_.resize(S_*F_);
+	next_operators_.resize(S_*F_);
+	std::iota(order_.begin(), order_.end(), 0);
+	if (options_.species_threads > 0) {
+	    // Every species position has its own cache so that the hits do not
+	    // depend on the order in which the threads run
+	    const size_t capacity = options_.cache_size > 0 ? std::max<size_t>(1, options_.cache_size / S_) : 0;
+	    caches_.assign(S_, FitnessCache(capacity));
+	    species_fails_.resize(S_);
+	    seeds_.resize(S_);
+	    next_mutated_at_.resize(S_*F_);
+	}
+	else {
+	    caches_.emplace_back(options_.cache_size);
+	}
+	if (options_.exhaustive) {
+	    Batch& batch = batches_[0];
+	    batch.inputs.resize(func_.input_count());
+	    std::iota(batch.inputs.begin(), batch.inputs.end(), Reg_t(0));
+	    batch.in_planes.resize(l_, batch.inputs.size());
+	    batch.in_planes.load(batch.inputs);
+	    // The inputs are in table order
+	    batch.expected = func_.planes();
+	}
     }
 
+    // Run at most the given number of generations, fewer if a stopping
+    // criterion is met. An optimizer that stopped does not run any more.
     template<typename Rng_t>
     void optimize(Rng_t& rng, unsigned generations, double ds, unsigned b) {
-	for (unsigned g = 0 ; g < generations ; ++g)
-	    run_generation(rng, ds, b);
+	for (unsigned g = 0 ; g < generations && stop_reason_ == StopReason::None ; ++g) {
+	    const double gen_ds = options_.adaptive ? control_.ds(ds) : ds;
+	    const unsigned gen_b = options_.adaptive ? control_.b(b, func_.input_count()) : b;
+	    if (telemetry_)
+		begin_record(gen_ds, gen_b);
+	    if (options_.species_threads > 0)
+		run_generation_parallel(rng, gen_ds, gen_b);
+	    else
+		run_generation(rng, gen_ds, gen_b);
+	    if (telemetry_)
+		end_record();
+	    ++generation_;
+	    evaluations_ += S_*F_;
+	    stop_reason_ = check_stop();
+	    if (options_.stagnation_limit > 0 && stop_reason_ == StopReason::None)
+		restart_stagnant(rng);
+	}
     }
 
-    const std::vector<Circuit<Reg_t>>& population() const { return population_; }
+    StopReason stop_reason() const { return stop_reason_; }
+    bool stopped() const { return stop_reason_ != StopReason::None; }
+
+    // Send a record of every generation to the writer, labelled with the
+    // seed and restart of the optimization. Null disables the records.
+    void set_telemetry(TelemetryWriter* writer, int seed, unsigned restart) {
+	telemetry_ = writer;
+	record_.seed = seed;
+	record_.d = d_;
+	record_.restart = restart;
+    }
+
+    // Fitness of every individual on one newly sampled batch, evaluated
+    // sequentially without selection. The population is left unchanged.
+    template<typename Rng_t>
+    std::vector<double> evaluate(Rng_t& rng, double ds, unsigned b) {
+	if (!options_.exhaustive)
+	    sample_inputs(rng, ds, b, batches_[0]);
+	if (options_.incremental_interval > 0 && has_parents_)
+	    compute_prefix_states();
+	std::vector<double> fitness(S_*F_);
+	for (unsigned k = 0 ; k < S_*F_ ; ++k)
+	    fitness[k] = estimate_fitness(k, batches_[0], scratch_[0], caches_[0], nullptr);
+	return fitness;
+    }
+
+    // Number of generations run so far
+    unsigned generation() const { return generation_; }
+
+    // Write the state carried from one generation to the next. The RNG and
+    // the mutation strategy are not part of it.
+    void save(std::ostream& os) const {
+	snapshot::write(os, l_);
+	snapshot::write(os, d_);
+	snapshot::write(os, S_);
+	snapshot::write(os, F_);
+	snapshot::write(os, generation_);
+	snapshot::write(os, evaluations_);
+	population_.save(os);
+	hard_.save(os);
+	snapshot::write(os, order_);
+	snapshot::write(os, mutated_at_);
+	snapshot::write(os, operators_);
+	snapshot::write(os, has_parents_);
+	snapshot::write(os, survivor_fitness_);
+	snapshot::write(os, batches_[0].key);
+	snapshot::write(os, uint64_t(caches_.size()));
+	for (const auto& cache : caches_)
+	    cache.save(os);
+	control_.save(os);
+	snapshot::write(os, best_exact_);
+	snapshot::write(os, plateau_generations_);
+    }
+
+    // Restore a state saved by an optimizer constructed with the same
+    // parameters, returns false if it does not match
+    bool load(std::istream& is) {
+	unsigned l, d, S, F;
+	snapshot::read(is, l);
+	snapshot::read(is, d);
+	snapshot::read(is, S);
+	snapshot::read(is, F);
+	if (!is || l != l_ || d != d_ || S != S_ || F != F_)
+	    return false;
+	snapshot::read(is, generation_);
+	snapshot::read(is, evaluations_);
+	population_.load(is);
+	hard_.load(is);
+	snapshot::read(is, order_);
+	snapshot::read(is, mutated_at_);
+	snapshot::read(is, operators_);
+	snapshot::read(is, has_parents_);
+	snapshot::read(is, survivor_fitness_);
+	snapshot::read(is, batches_[0].key);
+	uint64_t num_caches = 0;
+	snapshot::read(is, num_caches);
+	if (num_caches != caches_.size())
+	    return false;
+	for (auto& cache : caches_)
+	    cache.load(is);
+	control_.load(is);
+	snapshot::read(is, best_exact_);
+	snapshot::read(is, plateau_generations_);
+	return static_cast<bool>(is);
+    }
+
+    const Population<Reg_t>& population() const { return population_; }
+
+    // Parents of the n families whose survivor had the highest fitness
+    std::vector<Circuit<Reg_t>> elites(unsigned n) const {
+	std::vector<unsigned> families(S_);
+	std::iota(families.begin(), families.end(), 0);
+	std::stable_sort(families.begin(), families.end(), [this](unsigned a, unsigned b) { return survivor_fitness_[a] > survivor_fitness_[b]; });
+	std::vector<Circuit<Reg_t>> circuits;
+	for (unsigned s = 0 ; s < std::min(n, S_) ; ++s)
+	    circuits.push_back(population_[families[s]*F_].circuit());
+	return circuits;
+    }
+
+    // Replace the families whose survivor had the lowest fitness by offspring
+    // of the given circuits
+    template<typename Rng_t>
+    void immigrate(Rng_t& rng, const std::vector<Circuit<Reg_t>>& circuits) {
+	std::vector<unsigned> families(S_);
+	std::iota(families.begin(), families.end(), 0);
+	std::stable_sort(families.begin(), families.end(), [this](unsigned a, unsigned b) { return survivor_fitness_[a] < survivor_fitness_[b]; });
+	for (unsigned i = 0 ; i < std::min<size_t>(circuits.size(), S_) ; ++i) {
+	    assert(circuits[i].l() == l_ && circuits[i].d() == d_);
+	    const unsigned s = families[i];
+	    for (unsigned j = 0 ; j < F_ ; ++j)
+		population_[s*F_+j].assign(circuits[i]);
+	    mutated_at_[s*F_] = d_;
+	    for (unsigned j = 1 ; j < F_ ; ++j)
+		mutated_at_[s*F_+j] = mutate(rng, population_[s*F_+j], operators_[s*F_+j]);
+	    survivor_fitness_[s] = std::numeric_limits<double>::max();
+	}
+    }
 
-    Circuit<Reg_t> compute_best() const {
-	Circuit<Reg_t> best = population_[0];
+    // Seed min(n, S) families from the n distinct circuits of at most d gates,
+    // e.g. the elites of an optimization with fewer gates, padded with Id
+    // gates. The other families keep their random circuits. Circuits are
+    // told apart by their hash.
+    template<typename Rng_t>
+    void warm_start(Rng_t& rng, const std::vector<Circuit<Reg_t>>& circuits) {
+	std::vector<Circuit<Reg_t>> seeds;
+	std::vector<uint64_t> hashes;
+	for (const auto& circuit : circuits) {
+	    if (std::find(hashes.begin(), hashes.end(), circuit.hash()) != hashes.end())
+		continue;
+	    hashes.push_back(circuit.hash());
+	    seeds.push_back(circuit.padded(d_));
+	}
+	immigrate(rng, seeds);
+    }
+
+    uint64_t cache_hits() const {
+	uint64_t hits = 0;
+	for (const auto& cache : caches_)
+	    hits += cache.hits();
+	return hits;
+    }
+
+    uint64_t cache_misses() const {
+	uint64_t misses = 0;
+	for (const auto& cache : caches_)
+	    misses += cache.misses();
+	return misses;
+    }
+
+    Circuit<Reg_t> compute_best() {
+	if (options_.exhaustive)
+	    return compute_best_exhaustive();
+	Circuit<Reg_t> best = population_[order_[0]].circuit();
 	double best_e = 1;
-	unsigned best_qc = population_[0].simplified(Func_t::output_size).quantum_cost();
-	for (auto&& circuit : population_) {
-	    const auto simp = circuit.simplified(Func_t::output_size);
-	    auto [e, fn, fp] = circuit.errors(Func_t{});
+	unsigned best_qc = best.simplified(func_.output_size()).quantum_cost();
+	for (unsigned k : order_) {
+	    const auto circuit = population_[k].circuit();
+	    const auto simp = circuit.simplified(func_.output_size());
+	    auto [e, fn, fp] = circuit.errors(func_);
 	    if ((e < best_e) || (e == best_e && best_qc > simp.quantum_cost())) {
 		best = circuit;
 		best_e = e;
@@ -47,84 +309,514 @@ public:
     }
 
 private:
+    const TruthTable& func_;
     const unsigned l_;
     const unsigned d_;
     const unsigned S_;
     const unsigned F_;
-    std::vector<Reg_t> fails_;
-    std::vector<Circuit<Reg_t>> population_;
+    const OptimizerOptions options_;
+    // Inputs with wrong outputs in the previous generations, from which a
+    // fraction 1-ds of every batch is drawn, and the fails of a species
+    HardExamples<Reg_t> hard_;
+    std::vector<typename HardExamples<Reg_t>::Fail> new_fails_;
+    // The population is stored by family: the offspring of survivor s are at
+    // [s*F, (s+1)*F) with the unmodified copy first. Species are formed from
+    // the shuffled order_ and mutated_at_ holds the first gate in which an
+    // individual differs from its parent. The next generation is built in a
+    // second arena and the two are swapped.
+    Population<Reg_t> population_;
+    Population<Reg_t> next_population_;
+    std::vector<unsigned> order_;
+    std::vector<unsigned> mutated_at_;
+    // Operator of the mutation of every individual with the adaptive control
+    std::vector<MutationOperator> operators_;
+    bool has_parents_ = false;
+    unsigned generation_ = 0;
     MutStrat_t& mut_strat_;
+    AdaptiveControl control_;
+    std::vector<unsigned> survivors_;
+    // Fitness of the survivor each family of the population descends from
+    std::vector<double> survivor_fitness_;
+    std::vector<double> fitness_;
+    // Fitness of every individual in the current generation and, with the
+    // adaptive control and one batch per species, of its parent on the batch
+    // of its species
+    std::vector<double> individual_fitness_;
+    std::vector<double> parent_fitness_;
 
-    template<typename Rng_t>
-    std::pair<std::vector<double>, std::vector<Reg_t>> estimate_fitness(Rng_t& rng, const Circuit<Reg_t>* circuits, unsigned n, double ds, unsigned b) {
-	const unsigned num_fails = std::min(static_cast<unsigned>(fails_.size()), static_cast<unsigned>((1.-ds)*b));
-	// Sample num_fails fails without replacement
-	std::vector<Reg_t> inputs(b);
-	for (unsigned i = 0 ; i < num_fails ; ++i) {
-	    std::uniform_int_distribution<unsigned> dist(0, fails_.size()-i-1);
-	    const unsigned idx = dist(rng);
-	    inputs[i] = fails_[idx];
-	    std::swap(fails_[idx], fails_[fails_.size()-i-1]);
+    // Sampled inputs with their expected outputs in bit-planes and a key
+    // identifying the batch in the fitness cache
+    struct Batch {
+	std::vector<Reg_t> inputs;
+	std::vector<Reg_t> exact;
+	BitSlicedRegisters<> in_planes;
+	BitSlicedRegisters<> expected;
+	uint64_t key = 0;
+    };
+
+    // Simulation scratch space of a thread
+    struct Scratch {
+	BitSlicedRegisters<> outputs;
+	CompiledCircuit<Reg_t> compiled;
+    };
+
+    // One batch and scratch space per thread, all reused across generations.
+    // The first batch is the one shared by all species.
+    std::vector<Batch> batches_;
+    std::vector<Scratch> scratch_;
+    // Cached states of the parents, prefix_states_[s*num_prefixes()+j] holds
+    // the registers of parent s after its first j*incremental_interval gates
+    std::vector<BitSlicedRegisters<>> prefix_states_;
+    // Fitness values of already simulated circuits, keyed by their hash mixed
+    // with the key of the batch
+    std::vector<FitnessCache> caches_;
+    // Fails found by every species, merged to one per input of its batch, and
+    // the seeds of their RNG streams when the species are evaluated in
+    // parallel
+    std::vector<std::vector<typename HardExamples<Reg_t>::Fail>> species_fails_;
+    std::vector<uint64_t> seeds_;
+    std::vector<unsigned> next_mutated_at_;
+    // Operators of the mutations of the next population, kept apart until the
+    // adaptive control has seen those of the current one
+    std::vector<MutationOperator> next_operators_;
+    // Record of the running generation and the phase times of every species
+    // when they are evaluated in parallel
+    TelemetryWriter* telemetry_ = nullptr;
+    GenerationRecord record_;
+    std::chrono::steady_clock::time_point record_start_;
+    std::vector<PhaseTimes> species_phases_;
+    // State of the stopping criteria and of the restarts: the best exact
+    // fitness of a survivor and the generations since it was reached
+    StopReason stop_reason_ = StopReason::None;
+    uint64_t evaluations_ = 0;
+    double best_exact_ = 0;
+    unsigned plateau_generations_ = 0;
+    // Exact fitness of the survivors already checked on the full truth table
+    FitnessCache verified_;
+    const std::chrono::steady_clock::time_point start_;
+
+    unsigned num_workers() const { return std::max(1u, options_.species_threads); }
+
+    // The exact fitness already is the error rate, no separate error pass is needed
+    Circuit<Reg_t> compute_best_exhaustive() {
+	if (options_.incremental_interval > 0 && has_parents_)
+	    compute_prefix_states();
+	unsigned best_k = order_[0];
+	double best_fit = -1;
+	unsigned best_qc = 0;
+	for (unsigned k : order_) {
+	    const double fit = estimate_fitness(k, batches_[0], scratch_[0], caches_[0], nullptr);
+	    if (fit < best_fit)
+		continue;
+	    const unsigned qc = population_[k].circuit().simplified(func_.output_size()).quantum_cost();
+	    if (fit > best_fit || best_qc > qc) {
+		best_k = k;
+		best_fit = fit;
+		best_qc = qc;
+	    }
 	}
+	return population_[best_k].circuit();
+    }
+
+    unsigned num_prefixes() const { return (d_ + options_.incremental_interval - 1) / options_.incremental_interval; }
+
+    // Sample a batch of inputs, drawing a fraction 1-ds of them from the hard
+    // examples and the rest uniformly. The hard examples are only read.
+    template<typename Rng_t>
+    void sample_inputs(Rng_t& rng, double ds, unsigned b, Batch& batch) {
+	const unsigned num_fails = std::min<size_t>(hard_.size(), static_cast<unsigned>((1.-ds)*b));
+	batch.inputs.resize(b);
+	for (unsigned i = 0 ; i < num_fails ; ++i)
+	    batch.inputs[i] = hard_.draw(rng);
 	// Sample the rest of the inputs randomly
-	const Reg_t max_input = (Reg_t(1) << Func_t::input_size) - 1;
-	std::uniform_int_distribution<Reg_t> dist(0, max_input);
+	// Drawn as 64-bit integers, the distribution does not take 8-bit or
+	// 128-bit registers
+	const uint64_t max_input = func_.input_count() - 1;
+	std::uniform_int_distribution<uint64_t> dist(0, max_input);
 	for (unsigned i = num_fails ; i < b ; ++i)
-	    inputs[i] = dist(rng);
-	// Simulate every circuit
-	std::vector<Reg_t> new_fails;
-	std::vector<double> fitness(n, 0);
-	std::vector<Reg_t> outputs;
-	for (unsigned i = 0 ; i < n ; ++i) {
-	    outputs = inputs;
-	    circuits[i].run(outputs);
-	    for (unsigned k = 0 ; k < b ; ++k) {
-		const Reg_t out = (outputs[k] >> (l_-Func_t::output_size)) & ((Reg_t(1) << Func_t::output_size) - 1);
-		const Reg_t exact = func_eval(inputs[k]);
-		for (int bit = 0 ; bit < Func_t::output_size ; ++bit) {
-		    if (((out>>bit)&1) == ((exact>>bit)&1))
-			fitness[i] += 1;
-		    else
-			new_fails.push_back(inputs[k]);
-		}
+	    batch.inputs[i] = Reg_t(dist(rng));
+	batch.key += 0x9e3779b97f4a7c15ull;
+	transpose_inputs(batch);
+    }
+
+    // Transpose the inputs and the exact outputs into bit-planes
+    void transpose_inputs(Batch& batch) {
+	batch.exact.resize(batch.inputs.size());
+	for (size_t k = 0 ; k < batch.inputs.size() ; ++k)
+	    batch.exact[k] = func_.func_eval(batch.inputs[k]);
+	batch.in_planes.resize(l_, batch.inputs.size());
+	batch.in_planes.load(batch.inputs);
+	batch.expected.resize(func_.output_size(), batch.exact.size());
+	batch.expected.load(batch.exact);
+    }
+
+    // Simulate the gates [first, d) of the circuit starting from the given
+    // state and compare the outputs with the expected ones. The inputs with
+    // wrong output bits are added to new_fails unless it is null.
+    template<typename Circuit_t>
+    double simulate(const Circuit_t& circuit, unsigned first, const BitSlicedRegisters<>& state, const Batch& batch, Scratch& scratch,
+		    std::vector<typename HardExamples<Reg_t>::Fail>* new_fails) {
+	BitSlicedRegisters<>& outputs = scratch.outputs;
+	outputs = state;
+	scratch.compiled.compile(circuit, first, circuit.d());
+	scratch.compiled.run(outputs);
+	const size_t b = batch.inputs.size();
+	const unsigned output_size = func_.output_size();
+	std::array<uint64_t, TruthTable::max_output_size> wrong;
+	unsigned num_wrong = 0;
+	for (size_t w = 0 ; w < outputs.words() ; ++w) {
+	    uint64_t any_wrong = 0;
+	    for (unsigned bit = 0 ; bit < output_size ; ++bit) {
+		wrong[bit] = (outputs.plane(l_-output_size+bit)[w] ^ batch.expected.plane(bit)[w]) & outputs.valid_mask(w);
+		num_wrong += std::popcount(wrong[bit]);
+		any_wrong |= wrong[bit];
+	    }
+	    // Every input is a fail counting its wrong output bits
+	    if (!new_fails)
+		continue;
+	    for (; any_wrong ; any_wrong &= any_wrong-1) {
+		const unsigned pos = std::countr_zero(any_wrong);
+		uint32_t count = 0;
+		for (unsigned bit = 0 ; bit < output_size ; ++bit)
+		    count += (wrong[bit] >> pos) & 1;
+		new_fails->push_back({batch.inputs[w*BitSlicedRegisters<>::word_bits + pos], count});
 	    }
-	    fitness[i] /= Func_t::output_size * b;
 	}
-	return {std::move(fitness), std::move(new_fails)};
+	return static_cast<double>(output_size*b - num_wrong) / (output_size * b);
+    }
+
+    // Simulate every parent on the shared batch and keep its intermediate states
+    void compute_prefix_states() {
+	const unsigned interval = options_.incremental_interval;
+	const unsigned np = num_prefixes();
+	prefix_states_.resize(S_*np);
+	#pragma omp parallel for schedule(dynamic) num_threads(num_workers())
+	for (unsigned s = 0 ; s < S_ ; ++s) {
+	    CompiledCircuit<Reg_t>& compiled = scratch_[omp_get_thread_num()].compiled;
+	    const ConstCircuitView<Reg_t> parent = population_[s*F_];
+	    prefix_states_[s*np] = batches_[0].in_planes;
+	    for (unsigned j = 1 ; j < np ; ++j) {
+		prefix_states_[s*np+j] = prefix_states_[s*np+j-1];
+		compiled.compile(parent, (j-1)*interval, j*interval);
+		compiled.run(prefix_states_[s*np+j]);
+	    }
+	}
+    }
+
+    // Fitness of the individual k, simulated from the last cached state of its
+    // parent before its mutation if possible
+    double estimate_fitness(unsigned k, const Batch& batch, Scratch& scratch, FitnessCache& cache, std::vector<typename HardExamples<Reg_t>::Fail>* new_fails) {
+	// Duplicates of a cached circuit do not add their fails again
+	const uint64_t key = population_[k].hash() ^ batch.key;
+	double fitness;
+	if (cache.capacity() > 0 && cache.lookup(key, fitness))
+	    return fitness;
+	if (options_.incremental_interval == 0 || !has_parents_) {
+	    fitness = simulate(population_[k], 0, batch.in_planes, batch, scratch, new_fails);
+	}
+	else {
+	    const unsigned np = num_prefixes();
+	    const unsigned j = std::min(mutated_at_[k] / options_.incremental_interval, np-1);
+	    fitness = simulate(population_[k], j*options_.incremental_interval, prefix_states_[(k/F_)*np+j], batch, scratch, new_fails);
+	}
+	cache.insert(key, fitness);
+	return fitness;
+    }
+
+    // Criterion met by the generation that just ran, if any
+    StopReason check_stop() {
+	if (options_.stop_on_exact) {
+	    for (unsigned s = 0 ; s < S_ ; ++s) {
+		if (survivor_fitness_[s] == 1 && exact_fitness(s) == 1)
+		    return StopReason::Exact;
+	    }
+	}
+	if (options_.plateau > 0 || options_.stagnation_limit > 0) {
+	    // The batch fitness of sampled inputs is too noisy to compare
+	    // across generations: one easy batch would set a mark that is
+	    // never reached again
+	    const unsigned fittest = std::max_element(survivor_fitness_.begin(), survivor_fitness_.end()) - survivor_fitness_.begin();
+	    const double exact = exact_fitness(fittest);
+	    if (exact > best_exact_) {
+		best_exact_ = exact;
+		plateau_generations_ = 0;
+	    }
+	    else {
+		++plateau_generations_;
+	    }
+	}
+	if (options_.plateau > 0 && plateau_generations_ >= options_.plateau)
+	    return StopReason::Plateau;
+	if (options_.max_evaluations > 0 && evaluations_ >= options_.max_evaluations)
+	    return StopReason::Evaluations;
+	if (options_.max_seconds > 0 && std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count() >= options_.max_seconds)
+	    return StopReason::Time;
+	return StopReason::None;
+    }
+
+    // Fitness on the full truth table of the parent of family s, which is a
+    // copy of survivor s after a generation
+    double exact_fitness(unsigned s) {
+	if (options_.exhaustive)
+	    return survivor_fitness_[s];
+	const ConstCircuitView<Reg_t> parent = population_[s*F_];
+	double fitness;
+	if (verified_.lookup(parent.hash(), fitness))
+	    return fitness;
+	fitness = 1 - std::get<0>(parent.circuit().errors(func_));
+	verified_.insert(parent.hash(), fitness);
+	return fitness;
+    }
+
+    // Re-randomize the families whose survivor is less fit than the median
+    // one if the survivors have stagnated
+    template<typename Rng_t>
+    void restart_stagnant(Rng_t& rng) {
+	if (plateau_generations_ == 0 || plateau_generations_ % options_.stagnation_limit != 0)
+	    return;
+	std::vector<double> sorted = survivor_fitness_;
+	std::nth_element(sorted.begin(), sorted.begin() + S_/2, sorted.end());
+	const double median = sorted[S_/2];
+	for (unsigned s = 0 ; s < S_ ; ++s) {
+	    if (survivor_fitness_[s] >= median)
+		continue;
+	    // The new circuits share no gates with a parent
+	    for (unsigned j = 0 ; j < F_ ; ++j) {
+		mut_strat_.randomize(rng, population_[s*F_+j]);
+		mutated_at_[s*F_+j] = 0;
+	    }
+	    survivor_fitness_[s] = 0;
+	}
+    }
+
+    void begin_record(double ds, unsigned b) {
+	record_.generation = generation_;
+	record_.phases = PhaseTimes();
+	record_.ds = ds;
+	record_.b = b;
+	record_.cache_hits = cache_hits();
+	record_.cache_misses = cache_misses();
+	record_start_ = std::chrono::steady_clock::now();
+    }
+
+    void end_record() {
+	record_.wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - record_start_).count();
+	record_.evaluations = S_*F_;
+	record_.best_fitness = *std::max_element(individual_fitness_.begin(), individual_fitness_.end());
+	record_.mean_fitness = std::accumulate(individual_fitness_.begin(), individual_fitness_.end(), 0.0) / individual_fitness_.size();
+	record_.fails = hard_.size();
+	record_.cache_hits = cache_hits() - record_.cache_hits;
+	record_.cache_misses = cache_misses() - record_.cache_misses;
+	telemetry_->record(record_);
     }
 
     template<typename Rng_t>
     void run_generation(Rng_t& rng, double ds, unsigned b) {
-	std::vector<Circuit<Reg_t>> new_population;
-	std::vector<Reg_t> new_fails;
-	new_population.reserve(S_*F_);
+	PhaseClock clock(telemetry_ != nullptr);
+	PhaseTimes& phases = record_.phases;
+	// Incremental evaluation needs one batch shared by all species
+	const bool incremental = options_.incremental_interval > 0;
+	if (incremental && !options_.exhaustive)
+	    sample_inputs(rng, ds, b, batches_[0]);
+	clock.lap(phases.sample_ns);
+	if (incremental && has_parents_)
+	    compute_prefix_states();
+	clock.lap(phases.simulate_ns);
+	for (unsigned i = 0 ; i < S_ ; ++i) {
+	    if (!incremental && !options_.exhaustive)
+		sample_inputs(rng, ds, b, batches_[0]);
+	    clock.lap(phases.sample_ns);
+	    // The fails are counted after every species to bound new_fails_
+	    new_fails_.clear();
+	    for (unsigned j = 0 ; j < F_ ; ++j) {
+		fitness_[j] = estimate_fitness(order_[F_*i+j], batches_[0], scratch_[0], caches_[0], options_.exhaustive ? nullptr : &new_fails_);
+		individual_fitness_[order_[F_*i+j]] = fitness_[j];
+	    }
+	    HardExamples<Reg_t>::merge(new_fails_);
+	    hard_.add(new_fails_);
+	    if (compare_on_species_batch())
+		evaluate_parents(i, batches_[0], scratch_[0], caches_[0]);
+	    clock.lap(phases.simulate_ns);
+	    const auto best_pos = std::max_element(fitness_.begin(), fitness_.end());
+	    survivors_[i] = order_[F_*i + std::distance(fitness_.begin(), best_pos)];
+	    survivor_fitness_[i] = *best_pos;
+	    clock.lap(phases.select_ns);
+	}
+	if (!options_.exhaustive)
+	    hard_.update();
+	clock.lap(phases.select_ns);
+	for (unsigned s = 0 ; s < S_ ; ++s) {
+	    copy_survivor(s);
+	    mutated_at_[s*F_] = d_;
+	    for (unsigned i = 1 ; i < F_ ; ++i)
+		mutated_at_[s*F_+i] = mutate(rng, next_population_[s*F_+i], next_operators_[s*F_+i]);
+	}
+	clock.lap(phases.mutate_ns);
+	// The mutations above still used the control of the previous generation
+	update_control();
+	std::swap(population_, next_population_);
+	std::swap(operators_, next_operators_);
+	has_parents_ = true;
+	std::iota(order_.begin(), order_.end(), 0);
+	std::shuffle(order_.begin(), order_.end(), rng);
+	clock.lap(phases.select_ns);
+    }
+
+    // Mutation drawing its operator from the adaptive control if enabled,
+    // which is recorded in op
+    template<typename Rng_t, typename Circuit_t>
+    unsigned mutate(Rng_t& rng, Circuit_t&& circuit, MutationOperator& op) const {
+	if (!options_.adaptive)
+	    return mut_strat_.mutate(rng, circuit);
+	op = control_.draw(rng);
+	return mut_strat_.mutate(rng, circuit, op);
+    }
+
+    // Whether the adaptive control needs the parents evaluated again on the
+    // batch of every species, which is not the one their copy was evaluated on
+    bool compare_on_species_batch() const {
+	return options_.adaptive && has_parents_ && options_.incremental_interval == 0 && !options_.exhaustive;
+    }
+
+    // Fitness of the parent of every offspring of species i on the batch of
+    // the species, once the species is evaluated. A parent in the species or
+    // shared with an earlier offspring is not simulated again, and no fails
+    // are collected.
+    void evaluate_parents(unsigned i, const Batch& batch, Scratch& scratch, FitnessCache& cache) {
+	const auto first = order_.begin() + F_*i;
+	const auto last = first + F_;
+	for (auto it = first ; it != last ; ++it) {
+	    const unsigned k = *it;
+	    const unsigned parent = k - k%F_;
+	    if (k == parent)
+		continue;
+	    if (std::find(first, last, parent) != last) {
+		parent_fitness_[k] = individual_fitness_[parent];
+		continue;
+	    }
+	    const auto sibling = std::find_if(first, it, [this, parent](unsigned m) { return m != parent && m - m%F_ == parent; });
+	    parent_fitness_[k] = sibling != it ? parent_fitness_[*sibling] : estimate_fitness(parent, batch, scratch, cache, nullptr);
+	}
+    }
+
+    // Feed the outcome of the evaluated generation to the adaptive control.
+    // Every offspring is compared with its parent evaluated on the same batch,
+    // the one of its species unless the batch is shared.
+    void update_control() {
+	if (!options_.adaptive)
+	    return;
+	if (has_parents_) {
+	    const bool shared_batch = options_.incremental_interval > 0 || options_.exhaustive;
+	    for (unsigned k = 0 ; k < S_*F_ ; ++k) {
+		const unsigned parent = k - k%F_;
+		if (k != parent)
+		    control_.record_mutation(operators_[k], individual_fitness_[k], shared_batch ? individual_fitness_[parent] : parent_fitness_[k]);
+	    }
+	}
+	for (unsigned s = 0 ; s < S_ ; ++s)
+	    control_.record_survivor(survivor_fitness_[s] == 1);
+	control_.update();
+    }
+
+    // Fill family s of the next population with copies of its survivor
+    void copy_survivor(unsigned s) {
+	const auto survivor = population_[survivors_[s]];
+	if (options_.rewrite_interval > 0 && (generation_ + 1) % options_.rewrite_interval == 0) {
+	    Circuit<Reg_t> circuit = survivor.circuit().simplified(func_.output_size());
+	    circuit.extend(d_ - circuit.d());
+	    for (unsigned j = 0 ; j < F_ ; ++j)
+		next_population_[s*F_+j].assign(circuit);
+	    return;
+	}
+	for (unsigned j = 0 ; j < F_ ; ++j)
+	    next_population_[s*F_+j].assign(survivor);
+    }
+
+    // Same as run_generation with the species evaluated and their survivor
+    // mutated concurrently. Every species uses its own RNG stream, batch
+    // scratch and cache, and the fails are merged in the order of the species.
+    template<typename Rng_t>
+    void run_generation_parallel(Rng_t& rng, double ds, unsigned b) {
+	PhaseClock clock(telemetry_ != nullptr);
+	PhaseTimes& phases = record_.phases;
+	const bool incremental = options_.incremental_interval > 0;
+	const bool shared_batch = incremental || options_.exhaustive;
+	if (incremental && !options_.exhaustive)
+	    sample_inputs(rng, ds, b, batches_[0]);
+	clock.lap(phases.sample_ns);
+	if (incremental && has_parents_)
+	    compute_prefix_states();
+	for (auto& seed : seeds_) {
+	    // Drawn in a fixed order, the evaluation order of an expression is not
+	    const uint32_t lo = rng();
+	    const uint32_t hi = rng();
+	    seed = (uint64_t(hi) << 32) | lo;
+	}
+	clock.lap(phases.simulate_ns);
+	if (telemetry_)
+	    species_phases_.assign(S_, PhaseTimes());
+	#pragma omp parallel for schedule(dynamic) num_threads(num_workers())
 	for (unsigned i = 0 ; i < S_ ; ++i) {
-	    auto [fit, fail] = estimate_fitness(rng, population_.data()+F_*i, F_, ds, b);
-	    new_fails.insert(new_fails.end(), fail.begin(), fail.end());
-	    const auto best_pos = std::max_element(fit.begin(), fit.end());
-	    const size_t best_idx = F_*i + std::distance(fit.begin(), best_pos);
-	    new_population.push_back(population_[best_idx]);
-	}
-	/*
-	std::sort(new_fails.begin(), new_fails.end());
-	const auto last = std::unique(new_fails.begin(), new_fails.end());
-	new_fails.erase(last, new_fails.end());
-	*/
-	fails_ = new_fails;
-	population_.clear();
-	population_.reserve(S_*F_);
-	for (const auto& circuit : new_population) {
-	    population_.push_back(circuit);
-	    for (unsigned i = 0 ; i < F_-1 ; ++i) {
-		auto temp_circuit = circuit;
-		mut_strat_.mutate(rng, temp_circuit);
-		population_.push_back(temp_circuit);
+	    const unsigned t = omp_get_thread_num();
+	    PhaseClock species_clock(telemetry_ != nullptr);
+	    // Mixed so that both halves of the seed reach a 32-bit engine, without
+	    // the allocation of a std::seed_seq
+	    Rng_t stream(static_cast<typename Rng_t::result_type>(splitmix64(seeds_[i] ^ splitmix64(i))));
+	    Batch& batch = shared_batch ? batches_[0] : batches_[t];
+	    if (!shared_batch) {
+		batch.key = seeds_[i];
+		sample_inputs(stream, ds, b, batch);
+	    }
+	    if (telemetry_)
+		species_clock.lap(species_phases_[i].sample_ns);
+	    species_fails_[i].clear();
+	    double best_fitness = -1;
+	    for (unsigned j = 0 ; j < F_ ; ++j) {
+		const double fitness = estimate_fitness(order_[F_*i+j], batch, scratch_[t], caches_[i], options_.exhaustive ? nullptr : &species_fails_[i]);
+		individual_fitness_[order_[F_*i+j]] = fitness;
+		if (fitness > best_fitness) {
+		    best_fitness = fitness;
+		    survivors_[i] = order_[F_*i+j];
+		}
 	    }
+	    survivor_fitness_[i] = best_fitness;
+	    // Only the distinct inputs of the batch are kept until the end of
+	    // the generation
+	    HardExamples<Reg_t>::merge(species_fails_[i]);
+	    if (compare_on_species_batch())
+		evaluate_parents(i, batch, scratch_[t], caches_[i]);
+	    if (telemetry_)
+		species_clock.lap(species_phases_[i].simulate_ns);
+	    // The family of survivor i only depends on the stream of species i
+	    copy_survivor(i);
+	    next_mutated_at_[i*F_] = d_;
+	    for (unsigned j = 1 ; j < F_ ; ++j)
+		next_mutated_at_[i*F_+j] = mutate(stream, next_population_[i*F_+j], next_operators_[i*F_+j]);
+	    if (telemetry_)
+		species_clock.lap(species_phases_[i].mutate_ns);
 	}
-	std::shuffle(population_.begin(), population_.end(), rng);
+	// The parallel section is accounted for by the species
+	clock.skip();
+	if (telemetry_) {
+	    for (const auto& species : species_phases_)
+		phases += species;
+	}
+	// The mutations above still used the control of the previous generation
+	update_control();
+	if (!options_.exhaustive) {
+	    for (const auto& fails : species_fails_)
+		hard_.add(fails);
+	    hard_.update();
+	}
+	std::swap(population_, next_population_);
+	std::swap(mutated_at_, next_mutated_at_);
+	std::swap(operators_, next_operators_);
+	has_parents_ = true;
+	std::iota(order_.begin(), order_.end(), 0);
+	std::shuffle(order_.begin(), order_.end(), rng);
+	clock.lap(phases.select_ns);
     }
 };
 
 
 #endif // OPTIMIZER_HH_
-
@@ -2,42 +2,26 @@
 
 import sys
 import matplotlib.pyplot as plt
-import qiskit
-import functions
-import qc_properties
 import tqdm
 import numpy as np
-from load_circuits import *
 from errors import *
 
 
 
 known_circuit_filename = sys.argv[1]
 optimized_circuit_filename = sys.argv[2]
-func = getattr(functions, 'Func'+sys.argv[3])()
+func_name = sys.argv[3]
 n_eval = int(sys.argv[4])
 min_err = float(sys.argv[5])
 max_err = float(sys.argv[6])
 errors = np.exp(np.linspace(np.log(min_err), np.log(max_err), n_eval))
 
-known_circuit = None
-with open(known_circuit_filename, 'r') as f:
-    source = f.read()
-    qc, circuit = tfc2qiskit(source)
-    known_circuit = circuit
-
-optimized_circuit = None
-with open(optimized_circuit_filename, 'r') as f:
-    source = f.read()
-    optimized_circuit = ascii2qiskit(source)
-
 err_known = []
 err_optim = []
 for i in tqdm.tqdm(range(n_eval)):
-    noise_model = reduce_noise(qc_properties.noise_model, 1./errors[i])
-    e, fn, fp = compute_error_rates(known_circuit, func, noise_model)
+    e, fn, fp = native_error_rates(known_circuit_filename, func_name, errors[i])
     err_known.append(e)
-    e, fn, fp = compute_error_rates(optimized_circuit, func, noise_model)
+    e, fn, fp = native_error_rates(optimized_circuit_filename, func_name, errors[i])
     err_optim.append(e)
 
 # Find a point where the two error probabilities cross
@@ -0,0 +1,121 @@
+#ifndef POPULATION_HH_
+#define POPULATION_HH_
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include <cassert>
+#include "instruction.hh"
+#include "circuit.hh"
+#include "checkpoint.hh"
+
+
+// Read-only view of a circuit stored in a Population, offering the subset of
+// the Circuit interface used by the simulators
+template<typename Reg_t>
+class ConstCircuitView {
+public:
+    ConstCircuitView(const Instruction<Reg_t>* inst, const uint64_t* hash, unsigned l, unsigned d) : inst_(inst), hash_(hash), l_(l), d_(d) {}
+    ConstCircuitView(const ConstCircuitView&) = default;
+    ConstCircuitView& operator=(const ConstCircuitView&) = delete;
+
+    const Instruction<Reg_t>& operator[](unsigned idx) const { return inst_[idx]; }
+
+    unsigned l() const { return l_; }
+    unsigned d() const { return d_; }
+    uint64_t hash() const { return *hash_; }
+
+    Circuit<Reg_t> circuit() const {
+	Circuit<Reg_t> c(l_, d_);
+	for (unsigned i = 0 ; i < d_ ; ++i)
+	    c.set(i, inst_[i]);
+	return c;
+    }
+
+private:
+    const Instruction<Reg_t>* inst_;
+    const uint64_t* hash_;
+    const unsigned l_;
+    const unsigned d_;
+};
+
+
+// Non-owning view of a circuit stored in a Population. It offers the subset of
+// the Circuit interface used by the mutation strategies and the simulators.
+template<typename Reg_t>
+class CircuitView {
+public:
+    CircuitView(Instruction<Reg_t>* inst, uint64_t* hash, unsigned l, unsigned d) : inst_(inst), hash_(hash), l_(l), d_(d) {}
+    CircuitView(const CircuitView&) = default;
+    CircuitView& operator=(const CircuitView&) = delete;
+
+    const Instruction<Reg_t>& operator[](unsigned idx) const { return inst_[idx]; }
+
+    void set(unsigned idx, const Instruction<Reg_t>& inst) {
+	*hash_ ^= zobrist(idx, inst_[idx]) ^ zobrist(idx, inst);
+	inst_[idx] = inst;
+    }
+
+    unsigned l() const { return l_; }
+    unsigned d() const { return d_; }
+    uint64_t hash() const { return *hash_; }
+
+    // Overwrite the gates with the ones of a circuit of the same size
+    template<typename Circuit_t>
+    void assign(const Circuit_t& circuit) {
+	for (unsigned i = 0 ; i < d_ ; ++i)
+	    inst_[i] = circuit[i];
+	*hash_ = circuit.hash();
+    }
+
+    Circuit<Reg_t> circuit() const { return ConstCircuitView<Reg_t>(*this).circuit(); }
+
+    operator ConstCircuitView<Reg_t>() const { return ConstCircuitView<Reg_t>(inst_, hash_, l_, d_); }
+
+private:
+    Instruction<Reg_t>* inst_;
+    uint64_t* hash_;
+    const unsigned l_;
+    const unsigned d_;
+};
+
+
+// Circuits of equal size stored back to back in a single arena
+template<typename Reg_t>
+class Population {
+public:
+    Population(size_t n, unsigned l, unsigned d) : genes_(n*d, Instruction<Reg_t>(Gate::Id, 0)), hashes_(n, Circuit<Reg_t>(l, d).hash()), l_(l), d_(d) {}
+    Population(const Population&) = default;
+    Population(Population&&) = default;
+    Population& operator=(const Population&) = default;
+    Population& operator=(Population&&) = default;
+
+    size_t size() const { return hashes_.size(); }
+    unsigned l() const { return l_; }
+    unsigned d() const { return d_; }
+
+    CircuitView<Reg_t> operator[](size_t k) { return CircuitView<Reg_t>(genes_.data()+k*d_, hashes_.data()+k, l_, d_); }
+    ConstCircuitView<Reg_t> operator[](size_t k) const { return ConstCircuitView<Reg_t>(genes_.data()+k*d_, hashes_.data()+k, l_, d_); }
+
+    void save(std::ostream& os) const {
+	snapshot::write(os, genes_);
+	snapshot::write(os, hashes_);
+    }
+
+    // The population has to have the size of the saved one
+    void load(std::istream& is) {
+	snapshot::read(is, genes_);
+	snapshot::read(is, hashes_);
+	assert(genes_.size() == hashes_.size()*d_);
+    }
+
+private:
+    std::vector<Instruction<Reg_t>> genes_;
+    std::vector<uint64_t> hashes_;
+    unsigned l_;
+    unsigned d_;
+};
+
+
+#endif // POPULATION_HH_
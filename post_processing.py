@@ -8,6 +8,7 @@ import qc_properties
 import functions
 import copy
 import tqdm
+import tempfile
 import numpy as np
 from load_circuits import *
 from errors import *
@@ -44,30 +45,33 @@ for fname in filter(lambda s:  s.startswith(FNAME) and s.endswith('.txt'), os.li
         parsed[-1]['qc'] = qc
         i += 1
 for fname in os.listdir('known_circuits/'+FNAME):
-    with open('known_circuits/'+FNAME+'/'+fname, 'r') as f:
+    path = 'known_circuits/'+FNAME+'/'+fname
+    with open(path, 'r') as f:
         source = f.read()
         qc, circuit = tfc2qiskit(source)
-        known_circuits.append({'qc':qc, 'circuit':circuit})
+        known_circuits.append({'qc':qc, 'circuit':circuit, 'path':path})
 
 # Sort the circuits in increasing order of quantum cost
 parsed = sorted(parsed, key = lambda t: t['qc'])
 
 for p in tqdm.tqdm(parsed, desc='Optimized'):
-    circuit = ascii2qiskit(p['circuit'], func.output_size)
-    e, fn, fp = compute_error_rates(circuit, func, reduce_noise(qc_properties.noise_model, NOISE_FACTOR))
-    p['e_noise'] = e
-    p['fn_noise'] = fn
-    p['fp_noise'] = fp
-    e, fn, fp = compute_error_rates(circuit, func, qc_properties.noise_model)
+    with tempfile.NamedTemporaryFile('w', suffix='.txt') as f:
+        f.write(p['circuit'] + '\n')
+        f.flush()
+        e, fn, fp = native_error_rates(f.name, FNAME, 1./NOISE_FACTOR)
+        p['e_noise'] = e
+        p['fn_noise'] = fn
+        p['fp_noise'] = fp
+        e, fn, fp = native_error_rates(f.name, FNAME)
     p['e_noise_melbourne'] = e
     p['fn_noise_melbourne'] = fn
     p['fp_noise_melbourne'] = fp
 for known in tqdm.tqdm(known_circuits, desc='Known'):
-    e, fn, fp = compute_error_rates(known['circuit'], func, reduce_noise(qc_properties.noise_model, NOISE_FACTOR))
+    e, fn, fp = native_error_rates(known['path'], FNAME, 1./NOISE_FACTOR)
     known['e_noise'] = e
     known['fn_noise'] = fn
     known['fp_noise'] = fp
-    e, fn, fp = compute_error_rates(known['circuit'], func, qc_properties.noise_model)
+    e, fn, fp = native_error_rates(known['path'], FNAME)
     known['e_noise_melbourne'] = e
     known['fn_noise_melbourne'] = fn
     known['fp_noise_melbourne'] = fp
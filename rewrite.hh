@@ -0,0 +1,275 @@
+#ifndef REWRITE_HH_
+#define REWRITE_HH_
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include "bits.hh"
+#include "instruction.hh"
+
+
+// Peephole rewriting of reversible circuits into equivalent ones, as
+// permutations of all the lines, with fewer gates or a lower quantum cost.
+// Every pass appends the gates one by one to a stack of kept gates and only
+// looks back a bounded number of gates, so its cost is linear in the number
+// of gates:
+// - a gate cancels an identical earlier gate it commutes with all the gates
+//   in between with, every gate being its own inverse, and an uncontrolled
+//   Swap cancels an identical earlier one through any gates, which are then
+//   relabelled,
+// - the gates on top of the stack are matched against a library of identity
+//   templates: a part of a template is replaced by the inverse of the rest
+//   when that is cheaper. The gates of a match may share controls on lines
+//   the template does not use.
+namespace rewrite {
+
+// Number of gates a pass looks back
+constexpr unsigned window = 32;
+
+
+// Gate of a template over the lines 0, 1 and 2 given as masks, a toggle if
+// target has one line and a swap if it has two
+struct TemplateGate {
+    uint8_t target;
+    uint8_t ctrl;
+};
+
+
+struct Template {
+    unsigned size;
+    unsigned lines;
+    std::array<TemplateGate, 5> gates;
+};
+
+
+// Circuits equal to the identity. A rotation of a template and its reverse
+// are identities as well.
+constexpr std::array<Template, 6> templates = {{
+    // Two cX sharing a line, conjugated by another cX
+    {5, 3, {{{2, 4}, {1, 2}, {2, 4}, {1, 2}, {1, 4}}}},
+    // Same with a Toffoli gate
+    {5, 3, {{{1, 6}, {2, 4}, {1, 6}, {2, 4}, {1, 4}}}},
+    // A NOT gate through the control of a cX
+    {5, 2, {{{1, 2}, {2, 0}, {1, 2}, {2, 0}, {1, 0}}}},
+    // Same with a Toffoli gate
+    {5, 3, {{{1, 6}, {2, 0}, {1, 6}, {2, 0}, {1, 4}}}},
+    // A Swap made of three cX
+    {4, 2, {{{1, 2}, {2, 1}, {1, 2}, {3, 0}}}},
+    // A Fredkin gate made of two cX and a Toffoli gate
+    {4, 3, {{{1, 2}, {2, 5}, {1, 2}, {3, 4}}}},
+}};
+
+
+template<typename Reg_t>
+bool is_identity(const Instruction<Reg_t>& g) {
+    return g.type() == Gate::Id || (g.is_swap() && !(g.target() & (g.target()-1)));
+}
+
+
+template<typename Reg_t>
+bool same(const Instruction<Reg_t>& a, const Instruction<Reg_t>& b) {
+    return a.type() == b.type() && a.target() == b.target() && a.ctrl() == b.ctrl() && a.neg() == b.neg();
+}
+
+
+template<typename Reg_t>
+bool is_plain_swap(const Instruction<Reg_t>& g) {
+    return g.type() == Gate::Swap;
+}
+
+
+// Sufficient condition for two gates to commute
+template<typename Reg_t>
+bool commute(const Instruction<Reg_t>& a, const Instruction<Reg_t>& b) {
+    if (is_identity(a) || is_identity(b))
+	return true;
+    // Toggles commute if neither flips a control of the other, even when they
+    // flip the same line
+    if (!a.is_swap() && !b.is_swap())
+	return !(a.target() & b.ctrl()) && !(b.target() & a.ctrl());
+    // Swaps of the same lines commute if they are not controlled by them
+    if (a.is_swap() && b.is_swap() && a.target() == b.target())
+	return !(a.target() & (a.ctrl() | b.ctrl()));
+    return !(a.target() & (b.target() | b.ctrl())) && !(b.target() & (a.target() | a.ctrl()));
+}
+
+
+// Gate with the lines a and b exchanged
+template<typename Reg_t>
+Instruction<Reg_t> relabel(const Instruction<Reg_t>& g, Reg_t ab) {
+    const auto exchange = [ab](Reg_t mask) {
+	return (mask & ab) == 0 || (mask & ab) == ab ? mask : Reg_t(mask ^ ab);
+    };
+    if (g.type() == Gate::Id)
+	return g;
+    return Instruction<Reg_t>(exchange(g.target()), exchange(g.ctrl()), exchange(g.neg()));
+}
+
+
+// Cancel the pairs of identical gates and drop the identities, returns
+// whether a gate was removed
+template<typename Reg_t>
+bool cancel(std::vector<Instruction<Reg_t>>& gates) {
+    std::vector<Instruction<Reg_t>> kept;
+    kept.reserve(gates.size());
+    for (const auto& g : gates) {
+	if (is_identity(g))
+	    continue;
+	bool cancelled = false;
+	const size_t last = kept.size() > window ? kept.size() - window : 0;
+	for (size_t k = kept.size() ; k > last ; --k) {
+	    if (same(kept[k-1], g)) {
+		if (is_plain_swap(g)) {
+		    for (size_t i = k ; i < kept.size() ; ++i)
+			kept[i] = relabel(kept[i], g.target());
+		}
+		kept.erase(kept.begin() + (k-1));
+		cancelled = true;
+		break;
+	    }
+	    if (!is_plain_swap(g) && !commute(kept[k-1], g))
+		break;
+	}
+	if (!cancelled)
+	    kept.push_back(g);
+    }
+    const bool changed = kept.size() < gates.size();
+    gates = std::move(kept);
+    return changed;
+}
+
+
+// Last p gates of the kept ones with the controls they share on lines none
+// of them flips and the other lines they use
+template<typename Reg_t>
+struct Suffix {
+    size_t first;
+    unsigned p;
+    Reg_t shared;
+    Reg_t neg;
+    Reg_t lines;
+
+    Suffix(const std::vector<Instruction<Reg_t>>& kept, unsigned p) : first(kept.size() - p), p(p), shared(~Reg_t(0)), neg(kept[first].neg()), lines(0) {
+	Reg_t targets = 0;
+	for (size_t i = first ; i < kept.size() ; ++i) {
+	    shared &= kept[i].ctrl();
+	    targets |= kept[i].target();
+	}
+	shared &= ~targets;
+	for (size_t i = first ; i < kept.size() ; ++i)
+	    lines |= kept[i].target() | (kept[i].ctrl() & ~shared);
+    }
+
+    // The templates only have positive controls
+    bool valid(const std::vector<Instruction<Reg_t>>& kept) const {
+	if (neg & ~shared)
+	    return false;
+	for (size_t i = first ; i < kept.size() ; ++i) {
+	    if (kept[i].neg() != neg)
+		return false;
+	}
+	return bits::popcount(lines) <= 3;
+    }
+};
+
+
+// Replace the suffix by the inverse of the rest of a template if it matches
+// its first gates, starting at gate r in direction dir
+template<typename Reg_t>
+bool match(std::vector<Instruction<Reg_t>>& kept, const Suffix<Reg_t>& suffix, const Template& t, unsigned r, int dir) {
+    const auto tgate = [&](unsigned j) { return t.gates[(r + t.size + dir*int(j)) % t.size]; };
+    if (bits::popcount(suffix.lines) != int(t.lines))
+	return false;
+    for (unsigned j = 0 ; j < suffix.p ; ++j) {
+	const auto& g = kept[suffix.first+j];
+	const TemplateGate tg = tgate(j);
+	if (bits::popcount(g.target()) != std::popcount(tg.target) || bits::popcount(Reg_t(g.ctrl() & ~suffix.shared)) != std::popcount(tg.ctrl))
+	    return false;
+    }
+    std::array<unsigned, 3> line;
+    Reg_t lines = suffix.lines;
+    for (unsigned i = 0 ; i < t.lines ; ++i, lines &= lines-1)
+	line[i] = bits::countr_zero(lines);
+    std::array<unsigned, 3> perm = {0, 1, 2};
+    do {
+	const auto map = [&](uint8_t mask) {
+	    Reg_t m = 0;
+	    for (unsigned i = 0 ; i < t.lines ; ++i) {
+		if ((mask >> i) & 1)
+		    m |= Reg_t(1) << line[perm[i]];
+	    }
+	    return m;
+	};
+	bool matches = true;
+	for (unsigned j = 0 ; j < suffix.p && matches ; ++j) {
+	    const auto& g = kept[suffix.first+j];
+	    matches = g.target() == map(tgate(j).target) && (g.ctrl() & ~suffix.shared) == map(tgate(j).ctrl);
+	}
+	if (!matches)
+	    continue;
+	std::vector<Instruction<Reg_t>> replacement;
+	for (unsigned j = t.size ; j > suffix.p ; --j)
+	    replacement.emplace_back(map(tgate(j-1).target), Reg_t(map(tgate(j-1).ctrl) | suffix.shared), suffix.neg);
+	unsigned old_cost = 0;
+	unsigned new_cost = 0;
+	for (size_t i = suffix.first ; i < kept.size() ; ++i)
+	    old_cost += kept[i].quantum_cost();
+	for (const auto& g : replacement)
+	    new_cost += g.quantum_cost();
+	if (replacement.size() > suffix.p || (replacement.size() == suffix.p && new_cost >= old_cost))
+	    return false;
+	kept.resize(suffix.first);
+	kept.insert(kept.end(), replacement.begin(), replacement.end());
+	return true;
+    } while (std::next_permutation(perm.begin(), perm.begin() + t.lines));
+    return false;
+}
+
+
+// Apply the templates to the gates, returns whether a template matched
+template<typename Reg_t>
+bool apply_templates(std::vector<Instruction<Reg_t>>& gates) {
+    constexpr unsigned max_size = 5;
+    std::vector<Instruction<Reg_t>> kept;
+    kept.reserve(gates.size());
+    bool changed = false;
+    for (const auto& g : gates) {
+	kept.push_back(g);
+	// Every match makes the circuit cheaper, so this terminates. The
+	// longest matches are tried first.
+	for (bool matched = true ; matched ;) {
+	    matched = false;
+	    for (unsigned p = std::min<size_t>(max_size, kept.size()) ; p >= 2 && !matched ; --p) {
+		const Suffix<Reg_t> suffix(kept, p);
+		if (!suffix.valid(kept))
+		    continue;
+		for (const Template& t : templates) {
+		    if (p > t.size || 2*p < t.size)
+			continue;
+		    for (unsigned r = 0 ; r < t.size && !matched ; ++r)
+			matched = match(kept, suffix, t, r, 1) || match(kept, suffix, t, r, -1);
+		    if (matched)
+			break;
+		}
+	    }
+	    changed = changed || matched;
+	}
+    }
+    gates = std::move(kept);
+    return changed;
+}
+
+
+template<typename Reg_t>
+void rewrite(std::vector<Instruction<Reg_t>>& gates) {
+    cancel(gates);
+    while (apply_templates(gates))
+	cancel(gates);
+}
+
+} // namespace rewrite
+
+
+#endif // REWRITE_HH_
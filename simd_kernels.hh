@@ -0,0 +1,241 @@
+#ifndef SIMD_KERNELS_HH_
+#define SIMD_KERNELS_HH_
+
+#include <cstddef>
+#include <cstdint>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+
+
+// Gate kernels over contiguous batches of registers. Every gate is expressed
+// as a masked XOR: a register is modified iff (reg ^ neg) & ctrl == ctrl, i.e.
+// the bits of ctrl are set except the negative controls in neg which are
+// cleared. This lets the same kernel handle X (ctrl = 0), cX, ccX and any
+// multi-controlled toggle, and all the controlled swaps.
+namespace simd {
+
+enum class Level { Scalar, AVX2, AVX512 };
+
+
+inline Level detect_level() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+	return Level::AVX512;
+    if (__builtin_cpu_supports("avx2"))
+	return Level::AVX2;
+#endif
+    return Level::Scalar;
+}
+
+
+// Level used by the kernels, defaults to the best level supported by the CPU
+inline Level& level() {
+    static Level lvl = detect_level();
+    return lvl;
+}
+
+
+template<typename Reg_t>
+constexpr bool has_vector_kernels = sizeof(Reg_t) == 1 || sizeof(Reg_t) == 2 || sizeof(Reg_t) == 4 || sizeof(Reg_t) == 8;
+
+
+// Scalar fallback, branch-free so that the compiler is free to vectorize it
+template<typename Reg_t>
+void toggle_scalar(Reg_t* regs, size_t n, Reg_t ctrl, Reg_t neg, Reg_t flip) {
+    for (size_t i = 0 ; i < n ; ++i)
+	regs[i] ^= flip & -Reg_t(((regs[i] ^ neg) & ctrl) == ctrl);
+}
+
+template<typename Reg_t>
+void swap_scalar(Reg_t* regs, size_t n, Reg_t ctrl, Reg_t neg, Reg_t t1, Reg_t t2) {
+    for (size_t i = 0 ; i < n ; ++i) {
+	const Reg_t differ = Reg_t(((regs[i] & t1) == 0) != ((regs[i] & t2) == 0));
+	const Reg_t active = Reg_t(((regs[i] ^ neg) & ctrl) == ctrl);
+	regs[i] ^= (t1 | t2) & -(differ & active);
+    }
+}
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+template<typename Reg_t>
+__attribute__((target("avx2"))) inline __m256i set1_avx2(Reg_t v) {
+    if constexpr (sizeof(Reg_t) == 1)
+	return _mm256_set1_epi8(static_cast<char>(v));
+    else if constexpr (sizeof(Reg_t) == 2)
+	return _mm256_set1_epi16(static_cast<short>(v));
+    else if constexpr (sizeof(Reg_t) == 4)
+	return _mm256_set1_epi32(static_cast<int>(v));
+    else
+	return _mm256_set1_epi64x(static_cast<long long>(v));
+}
+
+template<typename Reg_t>
+__attribute__((target("avx2"))) inline __m256i cmpeq_avx2(__m256i a, __m256i b) {
+    if constexpr (sizeof(Reg_t) == 1)
+	return _mm256_cmpeq_epi8(a, b);
+    else if constexpr (sizeof(Reg_t) == 2)
+	return _mm256_cmpeq_epi16(a, b);
+    else if constexpr (sizeof(Reg_t) == 4)
+	return _mm256_cmpeq_epi32(a, b);
+    else
+	return _mm256_cmpeq_epi64(a, b);
+}
+
+template<typename Reg_t>
+__attribute__((target("avx2"))) void toggle_avx2(Reg_t* regs, size_t n, Reg_t ctrl, Reg_t neg, Reg_t flip) {
+    constexpr size_t lanes = sizeof(__m256i) / sizeof(Reg_t);
+    const __m256i c = set1_avx2(ctrl);
+    const __m256i ng = set1_avx2(neg);
+    const __m256i f = set1_avx2(flip);
+    size_t i = 0;
+    for (; i + lanes <= n ; i += lanes) {
+	__m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(regs+i));
+	const __m256i active = cmpeq_avx2<Reg_t>(_mm256_and_si256(_mm256_xor_si256(r, ng), c), c);
+	r = _mm256_xor_si256(r, _mm256_and_si256(active, f));
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(regs+i), r);
+    }
+    toggle_scalar(regs+i, n-i, ctrl, neg, flip);
+}
+
+template<typename Reg_t>
+__attribute__((target("avx2"))) void swap_avx2(Reg_t* regs, size_t n, Reg_t ctrl, Reg_t neg, Reg_t t1, Reg_t t2) {
+    constexpr size_t lanes = sizeof(__m256i) / sizeof(Reg_t);
+    const __m256i c = set1_avx2(ctrl);
+    const __m256i ng = set1_avx2(neg);
+    const __m256i m1 = set1_avx2(t1);
+    const __m256i m2 = set1_avx2(t2);
+    const __m256i f = set1_avx2(Reg_t(t1 | t2));
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + lanes <= n ; i += lanes) {
+	__m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(regs+i));
+	const __m256i differ = _mm256_xor_si256(cmpeq_avx2<Reg_t>(_mm256_and_si256(r, m1), zero),
+						cmpeq_avx2<Reg_t>(_mm256_and_si256(r, m2), zero));
+	const __m256i active = cmpeq_avx2<Reg_t>(_mm256_and_si256(_mm256_xor_si256(r, ng), c), c);
+	r = _mm256_xor_si256(r, _mm256_and_si256(_mm256_and_si256(differ, active), f));
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(regs+i), r);
+    }
+    swap_scalar(regs+i, n-i, ctrl, neg, t1, t2);
+}
+
+
+template<typename Reg_t>
+__attribute__((target("avx512f,avx512bw"))) inline __m512i set1_avx512(Reg_t v) {
+    if constexpr (sizeof(Reg_t) == 1)
+	return _mm512_set1_epi8(static_cast<char>(v));
+    else if constexpr (sizeof(Reg_t) == 2)
+	return _mm512_set1_epi16(static_cast<short>(v));
+    else if constexpr (sizeof(Reg_t) == 4)
+	return _mm512_set1_epi32(static_cast<int>(v));
+    else
+	return _mm512_set1_epi64(static_cast<long long>(v));
+}
+
+template<typename Reg_t>
+__attribute__((target("avx512f,avx512bw"))) inline __m512i mask_xor_avx512(__m512i r, __mmask64 k, __m512i f) {
+    if constexpr (sizeof(Reg_t) == 1)
+	return _mm512_mask_blend_epi8(k, r, _mm512_xor_si512(r, f));
+    else if constexpr (sizeof(Reg_t) == 2)
+	return _mm512_mask_blend_epi16(static_cast<__mmask32>(k), r, _mm512_xor_si512(r, f));
+    else if constexpr (sizeof(Reg_t) == 4)
+	return _mm512_mask_xor_epi32(r, static_cast<__mmask16>(k), r, f);
+    else
+	return _mm512_mask_xor_epi64(r, static_cast<__mmask8>(k), r, f);
+}
+
+template<typename Reg_t>
+__attribute__((target("avx512f,avx512bw"))) inline __mmask64 cmpeq_avx512(__m512i a, __m512i b) {
+    if constexpr (sizeof(Reg_t) == 1)
+	return _mm512_cmpeq_epi8_mask(a, b);
+    else if constexpr (sizeof(Reg_t) == 2)
+	return _mm512_cmpeq_epi16_mask(a, b);
+    else if constexpr (sizeof(Reg_t) == 4)
+	return _mm512_cmpeq_epi32_mask(a, b);
+    else
+	return _mm512_cmpeq_epi64_mask(a, b);
+}
+
+template<typename Reg_t>
+__attribute__((target("avx512f,avx512bw"))) void toggle_avx512(Reg_t* regs, size_t n, Reg_t ctrl, Reg_t neg, Reg_t flip) {
+    constexpr size_t lanes = sizeof(__m512i) / sizeof(Reg_t);
+    const __m512i c = set1_avx512(ctrl);
+    const __m512i ng = set1_avx512(neg);
+    const __m512i f = set1_avx512(flip);
+    size_t i = 0;
+    for (; i + lanes <= n ; i += lanes) {
+	__m512i r = _mm512_loadu_si512(regs+i);
+	const __mmask64 active = cmpeq_avx512<Reg_t>(_mm512_and_si512(_mm512_xor_si512(r, ng), c), c);
+	r = mask_xor_avx512<Reg_t>(r, active, f);
+	_mm512_storeu_si512(regs+i, r);
+    }
+    toggle_scalar(regs+i, n-i, ctrl, neg, flip);
+}
+
+template<typename Reg_t>
+__attribute__((target("avx512f,avx512bw"))) void swap_avx512(Reg_t* regs, size_t n, Reg_t ctrl, Reg_t neg, Reg_t t1, Reg_t t2) {
+    constexpr size_t lanes = sizeof(__m512i) / sizeof(Reg_t);
+    const __m512i c = set1_avx512(ctrl);
+    const __m512i ng = set1_avx512(neg);
+    const __m512i m1 = set1_avx512(t1);
+    const __m512i m2 = set1_avx512(t2);
+    const __m512i f = set1_avx512(Reg_t(t1 | t2));
+    const __m512i zero = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + lanes <= n ; i += lanes) {
+	__m512i r = _mm512_loadu_si512(regs+i);
+	const __mmask64 differ = cmpeq_avx512<Reg_t>(_mm512_and_si512(r, m1), zero) ^ cmpeq_avx512<Reg_t>(_mm512_and_si512(r, m2), zero);
+	const __mmask64 active = cmpeq_avx512<Reg_t>(_mm512_and_si512(_mm512_xor_si512(r, ng), c), c);
+	r = mask_xor_avx512<Reg_t>(r, differ & active, f);
+	_mm512_storeu_si512(regs+i, r);
+    }
+    swap_scalar(regs+i, n-i, ctrl, neg, t1, t2);
+}
+
+#endif
+
+
+template<typename Reg_t>
+void toggle(Reg_t* regs, size_t n, Reg_t ctrl, Reg_t neg, Reg_t flip) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    if constexpr (has_vector_kernels<Reg_t>) {
+	switch (level()) {
+	    case Level::AVX512:
+		toggle_avx512(regs, n, ctrl, neg, flip);
+		return;
+	    case Level::AVX2:
+		toggle_avx2(regs, n, ctrl, neg, flip);
+		return;
+	    default:
+		break;
+	}
+    }
+#endif
+    toggle_scalar(regs, n, ctrl, neg, flip);
+}
+
+template<typename Reg_t>
+void swap(Reg_t* regs, size_t n, Reg_t ctrl, Reg_t neg, Reg_t t1, Reg_t t2) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    if constexpr (has_vector_kernels<Reg_t>) {
+	switch (level()) {
+	    case Level::AVX512:
+		swap_avx512(regs, n, ctrl, neg, t1, t2);
+		return;
+	    case Level::AVX2:
+		swap_avx2(regs, n, ctrl, neg, t1, t2);
+		return;
+	    default:
+		break;
+	}
+    }
+#endif
+    swap_scalar(regs, n, ctrl, neg, t1, t2);
+}
+
+} // namespace simd
+
+
+#endif // SIMD_KERNELS_HH_
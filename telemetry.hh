@@ -0,0 +1,236 @@
+#ifndef TELEMETRY_HH_
+#define TELEMETRY_HH_
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <array>
+#include <vector>
+#include <memory>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <filesystem>
+
+
+// Time spent in every phase of a generation
+struct PhaseTimes {
+    uint64_t sample_ns = 0;
+    uint64_t simulate_ns = 0;
+    uint64_t select_ns = 0;
+    uint64_t mutate_ns = 0;
+
+    PhaseTimes& operator+=(const PhaseTimes& other) {
+	sample_ns += other.sample_ns;
+	simulate_ns += other.simulate_ns;
+	select_ns += other.select_ns;
+	mutate_ns += other.mutate_ns;
+	return *this;
+    }
+};
+
+
+// Statistics of one generation of one optimization. In parallel generations
+// the phase times are summed over the threads, the wall time is not.
+struct GenerationRecord {
+    // Optimization the generation belongs to
+    int seed = 0;
+    unsigned d = 0;
+    unsigned restart = 0;
+    unsigned generation = 0;
+    uint64_t wall_ns = 0;
+    PhaseTimes phases;
+    // Fitness evaluations, including the cache hits
+    uint64_t evaluations = 0;
+    double best_fitness = 0;
+    double mean_fitness = 0;
+    uint64_t fails = 0;
+    uint64_t cache_hits = 0;
+    uint64_t cache_misses = 0;
+    // Fraction of random inputs and batch size of the generation
+    double ds = 0;
+    unsigned b = 0;
+};
+
+
+// Accumulates the time elapsed since the previous lap into a phase, or does
+// nothing if disabled so that runs without telemetry do not read the clock
+class PhaseClock {
+public:
+    explicit PhaseClock(bool enabled) : enabled_(enabled) {
+	if (enabled_)
+	    last_ = std::chrono::steady_clock::now();
+    }
+
+    void lap(uint64_t& phase_ns) {
+	if (!enabled_)
+	    return;
+	const auto now = std::chrono::steady_clock::now();
+	phase_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_).count();
+	last_ = now;
+    }
+
+    // Start the next lap without accounting for the elapsed time
+    void skip() {
+	if (enabled_)
+	    last_ = std::chrono::steady_clock::now();
+    }
+
+private:
+    bool enabled_;
+    std::chrono::steady_clock::time_point last_;
+};
+
+
+// Bounded single-producer single-consumer queue. The producer never waits: a
+// record pushed into a full ring is dropped and counted.
+template<typename T, size_t capacity>
+class SpscRing {
+    static_assert((capacity & (capacity-1)) == 0, "The capacity has to be a power of 2");
+
+public:
+    bool push(const T& value) {
+	const size_t head = head_.load(std::memory_order_relaxed);
+	if (head - tail_.load(std::memory_order_acquire) == capacity) {
+	    dropped_.fetch_add(1, std::memory_order_relaxed);
+	    return false;
+	}
+	slots_[head & (capacity-1)] = value;
+	head_.store(head+1, std::memory_order_release);
+	return true;
+    }
+
+    template<typename Fn_t>
+    size_t drain(Fn_t&& fn) {
+	const size_t tail = tail_.load(std::memory_order_relaxed);
+	const size_t head = head_.load(std::memory_order_acquire);
+	for (size_t k = tail ; k < head ; ++k)
+	    fn(slots_[k & (capacity-1)]);
+	tail_.store(head, std::memory_order_release);
+	return head - tail;
+    }
+
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    std::array<T, capacity> slots_;
+    // The producer and the consumer indices are on their own cache lines
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+    std::atomic<uint64_t> dropped_{0};
+};
+
+
+// Writes the generation records to a CSV file if its name ends with .csv and
+// to a JSON Lines file otherwise. Every thread pushes into its own ring,
+// registered on its first record, and a background thread drains the rings
+// into the file every flush interval and once more on destruction.
+class TelemetryWriter {
+public:
+    static constexpr size_t ring_capacity = 4096;
+    using Ring = SpscRing<GenerationRecord, ring_capacity>;
+
+    explicit TelemetryWriter(const std::string& path, std::chrono::milliseconds flush_interval = std::chrono::milliseconds(200))
+	: file_(path, std::ios::trunc), csv_(std::filesystem::path(path).extension() == ".csv"), flush_interval_(flush_interval) {
+	if (!file_) {
+	    std::cout << "Could not open telemetry file '" << path << "'" << std::endl;
+	    exit(1);
+	}
+	if (csv_)
+	    file_ << "seed,d,restart,generation,wall_ns,sample_ns,simulate_ns,select_ns,mutate_ns,evaluations,best_fitness,mean_fitness,fails,cache_hits,cache_misses,ds,b\n";
+	file_ << std::setprecision(9);
+	worker_ = std::thread([this] { run(); });
+    }
+
+    TelemetryWriter(const TelemetryWriter&) = delete;
+    TelemetryWriter& operator=(const TelemetryWriter&) = delete;
+
+    ~TelemetryWriter() {
+	{
+	    std::lock_guard<std::mutex> lock(mutex_);
+	    done_ = true;
+	}
+	cv_.notify_one();
+	worker_.join();
+	uint64_t dropped = 0;
+	for (const auto& ring : rings_)
+	    dropped += ring->dropped();
+	if (dropped > 0)
+	    std::cout << "Telemetry: " << dropped << " records dropped" << std::endl;
+    }
+
+    // Called by the optimizations, only the first record of a thread takes a lock
+    void record(const GenerationRecord& r) { ring().push(r); }
+
+private:
+    // Identifies the writer in the threads that registered a ring with it
+    const uint64_t id_ = next_id().fetch_add(1) + 1;
+    std::ofstream file_;
+    const bool csv_;
+    const std::chrono::milliseconds flush_interval_;
+    // Rings of the threads in registration order, guarded by mutex_
+    std::vector<std::unique_ptr<Ring>> rings_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool done_ = false;
+    std::thread worker_;
+
+    static std::atomic<uint64_t>& next_id() {
+	static std::atomic<uint64_t> id{0};
+	return id;
+    }
+
+    Ring& ring() {
+	// A thread keeps its ring for the writer it was registered with
+	thread_local uint64_t owner = 0;
+	thread_local Ring* ring = nullptr;
+	if (owner != id_) {
+	    std::lock_guard<std::mutex> lock(mutex_);
+	    rings_.push_back(std::make_unique<Ring>());
+	    ring = rings_.back().get();
+	    owner = id_;
+	}
+	return *ring;
+    }
+
+    void run() {
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true) {
+	    const bool done = cv_.wait_for(lock, flush_interval_, [this] { return done_; });
+	    // The rings are only added to, a ring drained while the lock is
+	    // released is still owned by rings_
+	    std::vector<Ring*> rings;
+	    for (const auto& r : rings_)
+		rings.push_back(r.get());
+	    lock.unlock();
+	    for (Ring* r : rings)
+		r->drain([this](const GenerationRecord& rec) { write(rec); });
+	    file_.flush();
+	    lock.lock();
+	    if (done)
+		return;
+	}
+    }
+
+    void write(const GenerationRecord& r) {
+	if (csv_) {
+	    file_ << r.seed << ',' << r.d << ',' << r.restart << ',' << r.generation << ',' << r.wall_ns << ',' << r.phases.sample_ns << ',' << r.phases.simulate_ns << ','
+		  << r.phases.select_ns << ',' << r.phases.mutate_ns << ',' << r.evaluations << ',' << r.best_fitness << ',' << r.mean_fitness << ',' << r.fails << ','
+		  << r.cache_hits << ',' << r.cache_misses << ',' << r.ds << ',' << r.b << '\n';
+	    return;
+	}
+	file_ << "{\"seed\": " << r.seed << ", \"d\": " << r.d << ", \"restart\": " << r.restart << ", \"generation\": " << r.generation
+	      << ", \"wall_ns\": " << r.wall_ns << ", \"sample_ns\": " << r.phases.sample_ns << ", \"simulate_ns\": " << r.phases.simulate_ns
+	      << ", \"select_ns\": " << r.phases.select_ns << ", \"mutate_ns\": " << r.phases.mutate_ns << ", \"evaluations\": " << r.evaluations
+	      << ", \"best_fitness\": " << r.best_fitness << ", \"mean_fitness\": " << r.mean_fitness << ", \"fails\": " << r.fails
+	      << ", \"cache_hits\": " << r.cache_hits << ", \"cache_misses\": " << r.cache_misses << ", \"ds\": " << r.ds << ", \"b\": " << r.b << "}\n";
+    }
+};
+
+
+#endif // TELEMETRY_HH_
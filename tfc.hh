@@ -0,0 +1,212 @@
+#ifndef TFC_HH_
+#define TFC_HH_
+
+#include <cstdint>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include "bits.hh"
+#include "instruction.hh"
+#include "circuit.hh"
+
+
+// Circuit read from a RevLib TFC file. The inputs are on the first lines in
+// the order of .i, followed by the other variables in the order of .v and by
+// the outputs that are not inputs, so that the outputs end up on the last
+// lines as the optimizer expects.
+template<typename Reg_t>
+struct TfcCircuit {
+    Circuit<Reg_t> circuit;
+    unsigned input_size = 0;
+    unsigned output_size = 0;
+    // Quantum cost given on the first line of the file, 0 if there is none
+    unsigned quantum_cost = 0;
+};
+
+
+namespace tfc {
+
+inline std::vector<std::string> split(const std::string& str, char sep) {
+    std::vector<std::string> parts;
+    std::istringstream is(str);
+    for (std::string part ; std::getline(is, part, sep) ;) {
+	part.erase(std::remove_if(part.begin(), part.end(), [](unsigned char c) { return std::isspace(c); }), part.end());
+	if (!part.empty())
+	    parts.push_back(part);
+    }
+    return parts;
+}
+
+[[noreturn]] inline void fail(const std::string& message, const std::string& line) {
+    std::cout << "TFC: " << message << ": '" << line << "'" << std::endl;
+    exit(1);
+}
+
+} // namespace tfc
+
+
+// Toffoli and Fredkin gates with any number of controls are supported, the
+// primed controls being negative ones
+template<typename Reg_t>
+TfcCircuit<Reg_t> read_tfc(std::istream& is) {
+    TfcCircuit<Reg_t> result;
+    std::vector<std::string> variables;
+    std::vector<std::string> inputs;
+    std::vector<std::string> outputs;
+    std::vector<unsigned> constants;
+    std::map<std::string, unsigned> lines;
+    std::vector<Instruction<Reg_t>> gates;
+    bool in_body = false;
+    for (std::string line ; std::getline(is, line) ;) {
+	line = line.substr(0, line.find('#'));
+	std::istringstream ls(line);
+	std::string keyword;
+	if (!(ls >> keyword))
+	    continue;
+	std::string rest;
+	std::getline(ls, rest);
+	if (!in_body) {
+	    if (std::all_of(keyword.begin(), keyword.end(), [](unsigned char c) { return std::isdigit(c); })) {
+		result.quantum_cost = std::stoul(keyword);
+	    }
+	    else if (keyword == ".v") {
+		variables = tfc::split(rest, ',');
+	    }
+	    else if (keyword == ".i") {
+		inputs = tfc::split(rest, ',');
+	    }
+	    else if (keyword == ".o") {
+		outputs = tfc::split(rest, ',');
+	    }
+	    else if (keyword == ".c") {
+		for (const auto& c : tfc::split(rest, ','))
+		    constants.push_back(std::stoul(c));
+	    }
+	    else if (keyword == "BEGIN" || keyword == "begin") {
+		in_body = true;
+		// Number the lines
+		for (const auto& var : inputs)
+		    lines.emplace(var, lines.size());
+		for (const auto& var : variables) {
+		    if (std::find(outputs.begin(), outputs.end(), var) == outputs.end())
+			lines.emplace(var, lines.size());
+		}
+		for (const auto& var : outputs)
+		    lines.emplace(var, lines.size());
+		if (lines.size() != variables.size())
+		    tfc::fail("inputs and outputs have to be declared in .v", line);
+		if (lines.size() > CHAR_BIT*sizeof(Reg_t))
+		    tfc::fail("too many lines", line);
+		for (unsigned o = 0 ; o < outputs.size() ; ++o) {
+		    if (lines[outputs[o]] != lines.size() - outputs.size() + o)
+			tfc::fail("the outputs have to be the last lines", line);
+		}
+		// The constant inputs are the variables that are not inputs, in
+		// the order of .v
+		unsigned c = 0;
+		for (const auto& var : variables) {
+		    if (std::find(inputs.begin(), inputs.end(), var) != inputs.end())
+			continue;
+		    if (c < constants.size() && constants[c] == 1)
+			gates.emplace_back(Gate::X, lines[var]);
+		    ++c;
+		}
+	    }
+	    else if (keyword[0] != '.') {
+		tfc::fail("unexpected header line", line);
+	    }
+	    continue;
+	}
+	if (keyword == "END" || keyword == "end")
+	    break;
+	const char kind = std::tolower(keyword[0]);
+	if (kind != 't' && kind != 'f')
+	    tfc::fail("unknown gate", line);
+	const auto args = tfc::split(rest, ',');
+	const unsigned num_targets = kind == 't' ? 1 : 2;
+	if (args.size() < num_targets)
+	    tfc::fail("missing targets", line);
+	Reg_t target = 0;
+	Reg_t ctrl = 0;
+	Reg_t neg = 0;
+	for (unsigned a = 0 ; a < args.size() ; ++a) {
+	    std::string arg = args[a];
+	    const bool primed = arg.back() == '\'';
+	    if (primed)
+		arg.pop_back();
+	    const auto it = lines.find(arg);
+	    if (it == lines.end())
+		tfc::fail("unknown variable " + arg, line);
+	    const Reg_t bit = Reg_t(1) << it->second;
+	    if ((target | ctrl) & bit)
+		tfc::fail("repeated variable " + arg, line);
+	    // A prime on a target does not change the gate
+	    if (a + num_targets >= args.size()) {
+		target |= bit;
+	    }
+	    else {
+		ctrl |= bit;
+		if (primed)
+		    neg |= bit;
+	    }
+	}
+	gates.emplace_back(target, ctrl, neg);
+    }
+    result.input_size = inputs.size();
+    result.output_size = outputs.size();
+    result.circuit = Circuit<Reg_t>(lines.size(), gates.size());
+    for (unsigned i = 0 ; i < gates.size() ; ++i)
+	result.circuit.set(i, gates[i]);
+    return result;
+}
+
+
+// Name of a line in written TFC files
+inline std::string tfc_variable(unsigned line) {
+    return line < 26 ? std::string(1, 'a' + line) : "x" + std::to_string(line);
+}
+
+
+// Write a circuit whose first input_size lines are the inputs and last
+// output_size lines are the outputs, the other lines start at 0
+template<typename Reg_t>
+void write_tfc(std::ostream& os, const Circuit<Reg_t>& circuit, unsigned input_size, unsigned output_size) {
+    const auto join = [](unsigned first, unsigned last) {
+	std::string vars;
+	for (unsigned i = first ; i < last ; ++i)
+	    vars += (i > first ? "," : "") + tfc_variable(i);
+	return vars;
+    };
+    const auto line = [](Reg_t arg) { return tfc_variable(bits::countr_zero(arg)); };
+    os << circuit.quantum_cost() << '\n';
+    os << ".v " << join(0, circuit.l()) << '\n';
+    os << ".i " << join(0, input_size) << '\n';
+    os << ".o " << join(circuit.l()-output_size, circuit.l()) << '\n';
+    if (circuit.l() > input_size) {
+	os << ".c ";
+	for (unsigned i = input_size ; i < circuit.l() ; ++i)
+	    os << (i > input_size ? "," : "") << '0';
+	os << '\n';
+    }
+    os << "BEGIN\n";
+    for (unsigned i = 0 ; i < circuit.d() ; ++i) {
+	const auto& inst = circuit[i];
+	if (inst.type() == Gate::Id || (inst.is_swap() && bits::popcount(inst.target()) < 2))
+	    continue;
+	// Controls first and targets last, negative controls are primed
+	os << (inst.is_swap() ? 'f' : 't') << bits::popcount(inst.ctrl()) + bits::popcount(inst.target()) << ' ';
+	for (Reg_t c = inst.ctrl() ; c ; c &= c-1)
+	    os << line(c) << ((inst.neg() >> bits::countr_zero(c)) & 1 ? "'" : "") << ',';
+	for (Reg_t t = inst.target() ; t ; t &= t-1)
+	    os << line(t) << (t & (t-1) ? "," : "\n");
+    }
+    os << "END\n";
+}
+
+
+#endif // TFC_HH_
@@ -0,0 +1,183 @@
+#ifndef TRUTH_TABLE_HH_
+#define TRUTH_TABLE_HH_
+
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include "bit_sliced_registers.hh"
+
+
+// Function to optimize given by its outputs for every input, both as one
+// value per input and bit-sliced with one plane per output bit. The built-in
+// functions of functions.hh are tabulated once, other functions are read from
+// PLA or RevLib .spec files.
+class TruthTable {
+public:
+    static constexpr unsigned max_input_size = 24;
+    static constexpr unsigned max_output_size = 64;
+
+    TruthTable() = default;
+
+    TruthTable(unsigned input_size, unsigned output_size, std::vector<uint64_t> outputs)
+	: input_size_(input_size), output_size_(output_size), outputs_(std::move(outputs)), planes_(output_size_, outputs_) {
+	assert(input_size_ <= max_input_size && output_size_ <= max_output_size && outputs_.size() == input_count());
+    }
+
+    template<typename Func_t>
+    static TruthTable tabulate(const Func_t& func) {
+	std::vector<uint64_t> outputs(size_t(1) << Func_t::input_size);
+	for (size_t k = 0 ; k < outputs.size() ; ++k)
+	    outputs[k] = func.func_eval(uint64_t(k));
+	return TruthTable(Func_t::input_size, Func_t::output_size, std::move(outputs));
+    }
+
+    unsigned input_size() const { return input_size_; }
+    unsigned output_size() const { return output_size_; }
+    size_t input_count() const { return size_t(1) << input_size_; }
+
+    template<typename Reg_t>
+    Reg_t func_eval(Reg_t reg) const { return Reg_t(outputs_[static_cast<size_t>(reg)]); }
+
+    // Output bits of all the inputs in input order
+    const BitSlicedRegisters<>& planes() const { return planes_; }
+
+private:
+    unsigned input_size_ = 0;
+    unsigned output_size_ = 0;
+    std::vector<uint64_t> outputs_;
+    BitSlicedRegisters<> planes_;
+};
+
+
+namespace truth_table {
+
+[[noreturn]] inline void fail(const std::string& message, const std::string& line) {
+    std::cout << "Truth table: " << message << ": '" << line << "'" << std::endl;
+    exit(1);
+}
+
+} // namespace truth_table
+
+
+// Read a PLA file (.i, .o and cubes of inputs and outputs) or a RevLib .spec
+// file (.numvars, .constants, .garbage and rows of inputs and outputs). The
+// k-th input is the k-th bit of the input value and so on for the outputs.
+// An output is 1 for an input if a cube matching the input has a 1 for it,
+// don't care outputs are 0. Constant inputs of .spec files are dropped along
+// with the rows they do not match, and so are the garbage outputs.
+inline TruthTable read_truth_table(std::istream& is) {
+    unsigned num_inputs = 0;
+    unsigned num_outputs = 0;
+    std::string constants;
+    std::string garbage;
+    std::vector<uint64_t> outputs;
+    unsigned input_size = 0;
+    unsigned output_size = 0;
+    bool in_body = false;
+    for (std::string line ; std::getline(is, line) ;) {
+	line = line.substr(0, line.find('#'));
+	std::istringstream ls(line);
+	std::string keyword;
+	if (!(ls >> keyword))
+	    continue;
+	if (keyword == ".e" || keyword == ".end")
+	    break;
+	if (keyword[0] == '.') {
+	    if (in_body)
+		truth_table::fail("unexpected keyword", line);
+	    if (keyword == ".i")
+		ls >> num_inputs;
+	    else if (keyword == ".o")
+		ls >> num_outputs;
+	    else if (keyword == ".numvars") {
+		ls >> num_inputs;
+		num_outputs = num_inputs;
+	    }
+	    else if (keyword == ".constants")
+		ls >> constants;
+	    else if (keyword == ".garbage")
+		ls >> garbage;
+	    if (!ls)
+		truth_table::fail("invalid " + keyword, line);
+	    continue;
+	}
+	if (!in_body) {
+	    // The first row fixes the sizes
+	    in_body = true;
+	    if (constants.empty())
+		constants.assign(num_inputs, '-');
+	    if (garbage.empty())
+		garbage.assign(num_outputs, '-');
+	    if (constants.size() != num_inputs || garbage.size() != num_outputs)
+		truth_table::fail(".constants and .garbage need one entry per line", line);
+	    input_size = std::count(constants.begin(), constants.end(), '-');
+	    output_size = num_outputs - std::count(garbage.begin(), garbage.end(), '1');
+	    if (input_size == 0 || input_size > TruthTable::max_input_size || output_size == 0 || output_size > TruthTable::max_output_size)
+		truth_table::fail("unsupported number of inputs or outputs", line);
+	    outputs.assign(size_t(1) << input_size, 0);
+	}
+	const std::string& in = keyword;
+	std::string out;
+	if (!(ls >> out) || in.size() != num_inputs || out.size() != num_outputs)
+	    truth_table::fail("invalid row", line);
+	// The input cube as a value and the mask of its don't cares
+	uint64_t value = 0;
+	uint64_t dont_care = 0;
+	unsigned bit = 0;
+	bool matches = true;
+	for (unsigned k = 0 ; k < num_inputs ; ++k) {
+	    if (in[k] != '0' && in[k] != '1' && in[k] != '-')
+		truth_table::fail("invalid input", line);
+	    if (constants[k] != '-') {
+		matches = matches && (in[k] == '-' || in[k] == constants[k]);
+		continue;
+	    }
+	    if (in[k] == '1')
+		value |= uint64_t(1) << bit;
+	    else if (in[k] == '-')
+		dont_care |= uint64_t(1) << bit;
+	    ++bit;
+	}
+	uint64_t ones = 0;
+	bit = 0;
+	for (unsigned k = 0 ; k < num_outputs ; ++k) {
+	    if (out[k] != '0' && out[k] != '1' && out[k] != '-' && out[k] != '~')
+		truth_table::fail("invalid output", line);
+	    if (garbage[k] == '1')
+		continue;
+	    if (out[k] == '1')
+		ones |= uint64_t(1) << bit;
+	    ++bit;
+	}
+	if (!matches)
+	    continue;
+	// Every subset of the don't cares gives an input of the cube
+	for (uint64_t sub = dont_care ; ; sub = (sub - 1) & dont_care) {
+	    outputs[value | sub] |= ones;
+	    if (sub == 0)
+		break;
+	}
+    }
+    if (!in_body)
+	truth_table::fail("no rows", "");
+    return TruthTable(input_size, output_size, std::move(outputs));
+}
+
+
+inline TruthTable read_truth_table(const std::string& path) {
+    std::ifstream is(path);
+    if (!is) {
+	std::cout << "Could not open '" << path << "'" << std::endl;
+	exit(1);
+    }
+    return read_truth_table(is);
+}
+
+
+#endif // TRUTH_TABLE_HH_